@@ -1,6 +1,7 @@
 @echo on
 
 g++ -m64 -Wall -O2 -std=c++17 main.cpp -o collective_artificial_intelligence
+g++ -m64 -Wall -O2 -std=c++17 -DCAI_BENCHMARK main.cpp -o collective_artificial_intelligence_benchmark
 
 pause
 exit
\ No newline at end of file
@@ -1,545 +1,4078 @@
 #include <iostream> // used for input and output streams
-#include <thread> // used to pause after each step
-#include <conio.h> // used for getch()
+#include <thread> // used to pause after each step, and for the worker threads
 #include <chrono> // used to pause after each step
 #include <cmath> // used for sigmoid function in neural network
 #include <vector> // used for dynamic lists in student class
+#include <string> // used for reading command-line options
+#include <functional> // used for the friend-found event hook
+#include <cstdlib> // used for rand() (only for the kernel checks' test data) and atoi()
+#include <ctime> // used for seeding the random generator
+#include <atomic> // used for counting heap allocations
+#include <new> // used for replacing operator new
+#include <algorithm> // used for filling up the grid
+#include <mutex> // used by the thread pool
+#include <condition_variable> // used by the thread pool to wake up its workers
+#include <fstream> // used for saving the neural network
+#include <cstring> // used for checking the model file header
+#include <cstdint> // used for fixed-size fields in the model file
+#include <cstdio> // used for writing a whole frame to the terminal at once, and for replacing saved model files
+#include <array> // used for the weights of the compile-time sized network
+#include <filesystem> // used for cutting a damaged end off an experience log
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h> // used for memory-mapping the model file
+#else
+#include <sys/mman.h> // used for memory-mapping the model file
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 // GRID LAYOUT
-const int GRID_SIZE = 10;
+const int DEFAULT_GRID_SIZE = 10;
+const int MAX_GRID_SIZE = 20000; // biggest rows or cols accepted from the command line
 const char STUDENTS = 'S';
 const char WALL = '|';
 const char SPACE = '.';
 const char FRIEND = 'F';
 const char GATHER = 'G'; 
 
-// Using Definers to shorten certain common keyphrases
-using std::cout;
-using std::cin;
+// Using Definers to shorten certain common keyphrases
+using std::cout;
+using std::cin;
+
+// ==========================================
+//                   GRID
+// ==========================================
+// The map that the students walk around, sized at runtime (anything from the classic 10x10 up to
+// 10,000 x 10,000). Every cell is one byte, and the cells are stored in 16x16 tiles instead of row
+// by row, so the neighbours of a cell are almost always in the same few cache lines. The visit
+// counts are kept in a separate plane with the same tiled layout, as one byte each that stops at 255
+// (past a few visits the exact number doesn't matter, only which neighbour has fewer).
+// Every tile also keeps how many of its open spaces nobody has stepped on yet, plus one "fully
+// explored" bit, so finding the closest part of the map that still needs exploring only has to look
+// at tiles and not at every single space.
+class Grid {
+	public:
+		static constexpr int TILE_SHIFT = 4;            // tiles are 16x16 cells
+		static constexpr int TILE_SIZE = 1 << TILE_SHIFT;
+		static constexpr int TILE_MASK = TILE_SIZE - 1;
+		static constexpr int TILE_CELLS = TILE_SIZE * TILE_SIZE;
+		static const unsigned char MAX_VISITS = 255;    // visit counts stop going up here
+
+		int rows = 0; // the x coordinate goes from 0 to rows - 1
+		int cols = 0; // the y coordinate goes from 0 to cols - 1
+		unsigned long long layoutVersion = 0; // goes up whenever walls are added or removed
+
+		// Changes the size of the grid. The contents are undefined until clear() is called.
+		void resize(int newRows, int newCols) {
+			rows = newRows;
+			cols = newCols;
+			tileCols = (cols + TILE_MASK) >> TILE_SHIFT;
+			tileRows = (rows + TILE_MASK) >> TILE_SHIFT;
+			size_t tiles = (size_t)tileRows * tileCols;
+			cells.resize(tiles * TILE_CELLS);
+			visitCounts.resize(tiles * TILE_CELLS);
+			tileUnexplored.resize(tiles);
+			exploredBits.resize((tiles + 63) / 64);
+		}
+
+		// Fills up the grid with empty spaces and forgets all the visits
+		void clear() {
+			layoutVersion++;
+			std::fill(cells.begin(), cells.end(), SPACE);
+			std::fill(visitCounts.begin(), visitCounts.end(), 0);
+			std::fill(exploredBits.begin(), exploredBits.end(), 0);
+
+			// every space inside the grid starts out unexplored (tiles on the edges can stick out of it)
+			unexploredTiles = (int)tileUnexplored.size();
+			for (int tx = 0; tx < tileRows; ++tx) {
+				int height = std::min(TILE_SIZE, rows - (tx << TILE_SHIFT));
+				for (int ty = 0; ty < tileCols; ++ty) {
+					int width = std::min(TILE_SIZE, cols - (ty << TILE_SHIFT));
+					tileUnexplored[(size_t)tx * tileCols + ty] = (unsigned short)(height * width);
+				}
+			}
+		}
+
+		// Where cell (x, y) lives inside the tiled storage
+		size_t index(int x, int y) const {
+			size_t tile = (size_t)(x >> TILE_SHIFT) * tileCols + (y >> TILE_SHIFT);
+			return (tile << (2 * TILE_SHIFT)) | ((x & TILE_MASK) << TILE_SHIFT) | (y & TILE_MASK);
+		}
+
+		bool inBounds(int x, int y) const {
+			return x >= 0 && x < rows && y >= 0 && y < cols;
+		}
+
+		// checks if the space is within the confines of the grid, and is not a wall
+		bool isOpen(int x, int y) const {
+			return inBounds(x, y) && cells[index(x, y)] != WALL;
+		}
+
+		char at(int x, int y) const { return cells[index(x, y)]; }
+		void set(int x, int y, char cell) {
+			size_t i = index(x, y);
+			char &current = cells[i];
+			if ((cell == WALL) != (current == WALL)) {
+				layoutVersion++;
+				// walls never need exploring, so a new wall on an unvisited space takes it off the tile's count
+				if (visitCounts[i] == 0) {
+					if (cell == WALL) markExplored(i);
+					else markUnexplored(i);
+				}
+			}
+			current = cell;
+		}
+
+		// Number of cells in the tiled storage (a bit more than rows * cols when the tiles stick out)
+		size_t storageSize() const { return cells.size(); }
+
+		unsigned char visits(int x, int y) const { return visitCounts[index(x, y)]; }
+
+		// +1 to the visit count of this space
+		void visit(int x, int y) {
+			size_t i = index(x, y);
+			unsigned char& count = visitCounts[i];
+			if (count == 0) markExplored(i); // first time anyone has been here
+			if (count < MAX_VISITS) count++;
+		}
+
+		// True once every open space in the tile holding (x, y) has been visited at least once
+		bool tileExplored(int x, int y) const {
+			size_t tile = index(x, y) >> (2 * TILE_SHIFT);
+			return (exploredBits[tile >> 6] >> (tile & 63)) & 1;
+		}
+
+		// Finds an unvisited open space in the closest tile (counting in tiles, diagonals are 1) to (x, y)
+		// that still has one, picking the space in that tile closest to (x, y). Searches outwards ring by
+		// ring, skipping 64 explored tiles at a time where it can, and stops at the first ring that has
+		// one, so it's quick while the frontier is nearby. Returns false if the whole map is explored.
+		bool nearestUnexplored(int x, int y, int &outX, int &outY) const {
+			if (unexploredTiles == 0) return false;
+			int homeX = x >> TILE_SHIFT, homeY = y >> TILE_SHIFT;
+			int maxRing = std::max(std::max(homeX, tileRows - 1 - homeX), std::max(homeY, tileCols - 1 - homeY));
+
+			for (int ring = 0; ring <= maxRing; ++ring) {
+				int bestTileX = -1, bestTileY = -1, bestDist = 0;
+				int top = homeX - ring, bottom = homeX + ring;
+				for (int tx = std::max(top, 0); tx <= std::min(bottom, tileRows - 1); ++tx) {
+					// the top and bottom rows of the ring are full rows, the ones in between only have both ends
+					bool fullRow = (tx == top || tx == bottom);
+					int step = fullRow ? 1 : 2 * ring;
+					for (int ty = fullRow ? std::max(homeY - ring, 0) : homeY - ring; ty <= homeY + ring; ty += step) {
+						if (ty < 0 || ty >= tileCols) continue;
+						size_t tile = (size_t)tx * tileCols + ty;
+						if (fullRow && (tile & 63) == 0 && ty + 63 <= std::min(homeY + ring, tileCols - 1) && exploredBits[tile >> 6] == ~0ULL) {
+							ty += 63; // 64 explored tiles in a row
+							continue;
+						}
+						if ((exploredBits[tile >> 6] >> (tile & 63)) & 1) continue;
+						int dist = std::abs(((tx << TILE_SHIFT) + TILE_SIZE / 2) - x) + std::abs(((ty << TILE_SHIFT) + TILE_SIZE / 2) - y);
+						if (bestTileX < 0 || dist < bestDist) {
+							bestTileX = tx; bestTileY = ty; bestDist = dist;
+						}
+					}
+				}
+				if (bestTileX >= 0) return closestUnvisitedIn(bestTileX, bestTileY, x, y, outX, outY);
+			}
+			return false;
+		}
+
+		// Counts every open space that can't be reached from any of the given starting spaces as already
+		// explored, so nobody ever heads for a space that's completely walled off. Students explore with
+		// up, down, left and right moves, so that's what this searches with too. Call it once the walls
+		// are in place (it doesn't get undone if walls change later, until the next clear()).
+		// queue is scratch space for the search (see World::searchQueue). The one bit per space that
+		// marks what was reached is only kept while this runs.
+		void sealUnreachable(const int* startX, const int* startY, int count, std::vector<int> &queue) {
+			std::vector<unsigned long long> reached((cells.size() + 63) / 64, 0);
+			auto reach = [&reached](size_t i) {
+				unsigned long long bit = 1ULL << (i & 63);
+				if (reached[i >> 6] & bit) return false;
+				reached[i >> 6] |= bit;
+				return true;
+			};
+			queue.resize((size_t)rows * cols);
+			size_t head = 0, tail = 0;
+			for (int s = 0; s < count; ++s) {
+				if (!reach(index(startX[s], startY[s]))) continue;
+				queue[tail++] = startX[s] * cols + startY[s];
+			}
+			const int dX[4] = {-1, 1, 0, 0};
+			const int dY[4] = {0, 0, -1, 1};
+			while (head < tail) {
+				int x = queue[head] / cols, y = queue[head] % cols;
+				head++;
+				for (int d = 0; d < 4; ++d) {
+					int nx = x + dX[d], ny = y + dY[d];
+					if (!isOpen(nx, ny) || !reach(index(nx, ny))) continue;
+					queue[tail++] = nx * cols + ny;
+				}
+			}
+
+			for (int x = 0; x < rows; ++x) {
+				for (int y = 0; y < cols; ++y) {
+					size_t i = index(x, y);
+					if (!(reached[i >> 6] & (1ULL << (i & 63))) && cells[i] != WALL && visitCounts[i] == 0) markExplored(i);
+				}
+			}
+		}
+
+	private:
+		int tileRows = 0;                        // number of tiles across the x direction
+		int tileCols = 0;                        // number of tiles across the y direction
+		int unexploredTiles = 0;                 // tiles that still have an unvisited open space
+		std::vector<char> cells;                 // stores the actual map for the grid
+		std::vector<unsigned char> visitCounts;  // stores how much times a space has been visited
+		std::vector<unsigned short> tileUnexplored;    // unvisited open spaces left in each tile
+		std::vector<unsigned long long> exploredBits;  // one bit per tile, set once the count above hits 0
+
+		// The space at storage index i doesn't need exploring anymore (it was visited, or became a wall)
+		void markExplored(size_t i) {
+			size_t tile = i >> (2 * TILE_SHIFT);
+			if (--tileUnexplored[tile] == 0) {
+				exploredBits[tile >> 6] |= 1ULL << (tile & 63);
+				unexploredTiles--;
+			}
+		}
+
+		// The unvisited space at storage index i needs exploring again (a wall was taken off it)
+		void markUnexplored(size_t i) {
+			size_t tile = i >> (2 * TILE_SHIFT);
+			if (tileUnexplored[tile]++ == 0) {
+				exploredBits[tile >> 6] &= ~(1ULL << (tile & 63));
+				unexploredTiles++;
+			}
+		}
+
+		// Unvisited open space in tile (tileX, tileY) that's closest to (x, y)
+		bool closestUnvisitedIn(int tileX, int tileY, int x, int y, int &outX, int &outY) const {
+			int bestDist = -1;
+			for (int cx = tileX << TILE_SHIFT; cx < std::min((tileX + 1) << TILE_SHIFT, rows); ++cx) {
+				for (int cy = tileY << TILE_SHIFT; cy < std::min((tileY + 1) << TILE_SHIFT, cols); ++cy) {
+					size_t i = index(cx, cy);
+					if (visitCounts[i] != 0 || cells[i] == WALL) continue;
+					int dist = std::abs(cx - x) + std::abs(cy - y);
+					if (bestDist < 0 || dist < bestDist) {
+						bestDist = dist; outX = cx; outY = cy;
+					}
+				}
+			}
+			return bestDist >= 0;
+		}
+};
+
+// ==========================================
+//              DISTANCE FIELD
+// ==========================================
+// How many moves every space is away from the friend, found with one breadth-first search out of the
+// friend's space. Students move the same way as when gathering (up to one step in x and one in y at
+// a time, so diagonals count as one move). Once the friend is found, every student only has to look
+// at their 8 neighbours and step to the one that's closer, which always gets them there on the
+// shortest path around the walls. It only gets rebuilt when the walls or the friend's location change.
+// Only the distance modulo 3 is kept, one byte per space: two neighbours are never more than one move
+// apart, so a neighbour is one move closer exactly when its distance is one less modulo 3.
+class DistanceField {
+	public:
+		static const unsigned char UNREACHABLE = 255; // the space is walled off from the friend
+
+		// Rebuilds the field if the grid's walls or the target changed since it was last built.
+		// queue is scratch space for the search (see World::searchQueue).
+		void ensure(const Grid &map, int targetX, int targetY, std::vector<int> &queue) {
+			if (built && map.layoutVersion == layoutVersion && targetX == builtX && targetY == builtY && &map == builtFor) return;
+			build(map, targetX, targetY, queue);
+		}
+
+		// Makes room for a grid this big up front, so building the field during a step doesn't allocate
+		void reserve(const Grid &map, std::vector<int> &queue) {
+			distances.reserve(map.storageSize());
+			queue.reserve((size_t)map.rows * map.cols);
+		}
+
+		// Moves from (x, y) to the target modulo 3, or UNREACHABLE
+		unsigned char at(int x, int y) const { return distances[builtFor->index(x, y)]; }
+
+		// Picks the neighbour of (x, y) that is one move closer to the target. preferX/preferY is tried
+		// first (so a straight line is kept whenever it's a shortest path), then the rest in a fixed order.
+		// Returns false if there's no way to get closer (already there, or walled off).
+		bool nextStep(int x, int y, int preferX, int preferY, int &outX, int &outY) const {
+			unsigned char here = at(x, y);
+			if (here == UNREACHABLE || (x == builtX && y == builtY)) return false;
+			unsigned char closer = PREVIOUS[here];
+
+			if (builtFor->isOpen(preferX, preferY) && at(preferX, preferY) == closer) {
+				outX = preferX; outY = preferY;
+				return true;
+			}
+			for (int d = 0; d < 8; ++d) {
+				int nx = x + NEIGHBOUR_X[d], ny = y + NEIGHBOUR_Y[d];
+				if (builtFor->isOpen(nx, ny) && at(nx, ny) == closer) {
+					outX = nx; outY = ny;
+					return true;
+				}
+			}
+			return false;
+		}
+
+	private:
+		static constexpr int NEIGHBOUR_X[8] = {-1, 1, 0, 0, -1, -1, 1, 1};
+		static constexpr int NEIGHBOUR_Y[8] = {0, 0, -1, 1, -1, 1, -1, 1};
+		static constexpr unsigned char NEXT[3] = {1, 2, 0};     // one move further, modulo 3
+		static constexpr unsigned char PREVIOUS[3] = {2, 0, 1}; // one move closer, modulo 3
+
+		std::vector<unsigned char> distances; // one per space, in the grid's tiled layout
+		const Grid* builtFor = nullptr;
+		unsigned long long layoutVersion = 0;
+		int builtX = -1, builtY = -1;
+		bool built = false;
+
+		void build(const Grid &map, int targetX, int targetY, std::vector<int> &queue) {
+			builtFor = &map;
+			layoutVersion = map.layoutVersion;
+			builtX = targetX;
+			builtY = targetY;
+			built = true;
+
+			distances.assign(map.storageSize(), UNREACHABLE);
+			queue.resize((size_t)map.rows * map.cols);
+			size_t head = 0, tail = 0;
+			distances[map.index(targetX, targetY)] = 0;
+			queue[tail++] = targetX * map.cols + targetY;
+
+			// every space is queued at most once, so this is O(spaces)
+			while (head < tail) {
+				int x = queue[head] / map.cols, y = queue[head] % map.cols;
+				head++;
+				unsigned char next = NEXT[distances[map.index(x, y)]];
+				for (int d = 0; d < 8; ++d) {
+					int nx = x + NEIGHBOUR_X[d], ny = y + NEIGHBOUR_Y[d];
+					if (!map.isOpen(nx, ny)) continue;
+					unsigned char &dist = distances[map.index(nx, ny)];
+					if (dist != UNREACHABLE) continue;
+					dist = next;
+					queue[tail++] = nx * map.cols + ny;
+				}
+			}
+		}
+};
+
+const unsigned char DistanceField::UNREACHABLE;
+constexpr int DistanceField::NEIGHBOUR_X[8];
+constexpr int DistanceField::NEIGHBOUR_Y[8];
+constexpr unsigned char DistanceField::NEXT[3];
+constexpr unsigned char DistanceField::PREVIOUS[3];
+
+// ==========================================
+//                  WORLD
+// ==========================================
+// Everything about one maze: the grid with its walls and visit counts, where the friend really is,
+// and the distance field to them. Several worlds can be simulated side by side (see --worlds),
+// so none of this is global.
+struct World {
+	Grid grid;                    // the grid the students walk around
+	int friendX = 0, friendY = 0; // stores actual location of the Friend
+	DistanceField friendDistance; // distances to the friend, used by the students once the friend is found
+	std::vector<int> searchQueue; // scratch space for every breadth-first search over the grid (one runs at a time)
+};
+
+// ==========================================
+//              RANDOM NUMBERS
+// ==========================================
+// Counter-based random numbers: the n-th number of a stream is just a hash of the stream's key and n
+// (SplitMix64's mixing function), so there's no shared state to lock and nothing depends on who asked
+// first. A key is built from the run's seed, the generation, what the numbers are for (the Stream) and
+// an index inside that (a student, a layer...), so a student's spawn spot only depends on the seed,
+// the generation and which student it is, no matter which thread sets it up or how many worlds run.
+class CounterRng {
+	public:
+		enum Stream : unsigned long long {
+			STREAM_WALLS = 1, // where the walls go
+			STREAM_FRIEND,    // where the friend hides
+			STREAM_STUDENTS,  // where each student starts (index = the student)
+			STREAM_WEIGHTS    // a new network's starting weights
+		};
+
+		CounterRng(unsigned long long seed, unsigned long long generation, Stream stream, unsigned long long index = 0)
+			: key(mix(mix(mix(mix(seed + GAMMA) ^ generation) ^ stream) ^ index)) {}
+
+		// The n-th number of the stream, without touching the counter
+		unsigned long long at(unsigned long long n) const { return mix(key + (n + 1) * GAMMA); }
+
+		// The next number of the stream
+		unsigned long long next() { return at(counter++); }
+
+		// A number from 0 to n - 1 (multiply-shift on the top 32 bits, so no slow division)
+		int below(int n) { return (int)(((next() >> 32) * (unsigned long long)n) >> 32); }
+
+		// A number from 0 (inclusive) to 1 (exclusive) with all 53 bits of a double filled in
+		double uniform() { return (double)(next() >> 11) * (1.0 / 9007199254740992.0); }
+
+	private:
+		static const unsigned long long GAMMA = 0x9E3779B97F4A7C15ULL; // 2^64 / golden ratio, SplitMix64's step
+		unsigned long long key;
+		unsigned long long counter = 0;
+
+		static unsigned long long mix(unsigned long long z) {
+			z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+			z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+			return z ^ (z >> 31);
+		}
+};
+
+// ==========================================
+//            ALLOCATION COUNTER
+// ==========================================
+// Every heap allocation in the program goes through here, which lets the headless
+// summary prove that the simulation steps themselves never touch the heap.
+std::atomic<long long> heapAllocations{0};
+
+// new and delete are all kept out of line so the compiler doesn't mistake the malloc()/free() inside for
+// a mismatched new/free pair
+#ifdef __GNUC__
+__attribute__((noinline))
+#endif
+void* operator new(std::size_t size) {
+	heapAllocations.fetch_add(1, std::memory_order_relaxed);
+	void* p = malloc(size ? size : 1);
+	if (!p) throw std::bad_alloc();
+	return p;
+}
+
+#ifdef __GNUC__
+__attribute__((noinline))
+#endif
+void operator delete(void* p) noexcept { free(p); }
+#ifdef __GNUC__
+__attribute__((noinline))
+#endif
+void operator delete(void* p, std::size_t) noexcept { ::operator delete(p); }
+
+// ==========================================
+//                 PROFILER
+// ==========================================
+// Timers and counters for finding out where a generation spends its time. Only built with
+// -DCAI_PROFILE: without it every PROFILE_ macro is empty and none of this is compiled.
+// Timers only go on the main thread (around whole phases, never inside the parallel loops), and
+// counters can be bumped from any thread. While a round of worlds is being timed, the timers inside
+// the worlds are left out: the main thread runs some of the worlds itself, so what they'd add up to
+// would depend on --threads.
+enum ProfilePhase {
+	PHASE_GENERATE,       // building the maze and spawning everyone
+	PHASE_STEP,           // one whole simulationStep()
+	PHASE_DISTANCE_FIELD, // making sure the distance field to the friend is up to date
+	PHASE_PLAN,           // planning every student's move
+	PHASE_PREDICT,        // running the network for the students that need it
+	PHASE_DECIDE,         // breaking the ties and recording the history
+	PHASE_COMMIT,         // sorting out who gets which space and moving everyone
+	PHASE_RENDER,         // drawing the grid and the rest of the console output
+	PHASE_TRAIN,          // gathering the successful paths and training on them
+	PHASE_WORLDS,         // running a whole round of worlds side by side (--worlds)
+	PHASE_COUNT
+};
+
+enum ProfileCounter {
+	COUNTER_PREDICTIONS,      // rows run through the network
+	COUNTER_CACHE_HITS,       // predictions answered by the policy cache
+	COUNTER_FRONTIER_SEARCHES,// times a student had to search for a new unexplored space
+	COUNTER_FRONTIER_STALLS,  // times a wall stopped a student on the way there (like the old wiggle retries)
+	COUNTER_STEP_ALLOCATIONS, // heap allocations made while stepping
+	COUNTER_COUNT
+};
+
+#ifdef CAI_PROFILE
+class Profiler {
+	public:
+		static const int BUCKETS = 40;            // histogram bucket b holds times from 2^(b-1) to 2^b nanoseconds
+		static const int TRACE_CAPACITY = 1 << 20; // trace events kept at most (the rest are counted and dropped)
+
+		Profiler() : origin(std::chrono::steady_clock::now()), mainThread(std::this_thread::get_id()) {
+			for (int c = 0; c < COUNTER_COUNT; ++c) counters[c] = 0;
+		}
+
+		// Starts keeping trace events (the memory is set aside now, so recording never allocates)
+		void enableTrace() {
+			trace.resize(TRACE_CAPACITY);
+			tracing = true;
+		}
+
+		// Called when a phase starts being timed. Opening PHASE_WORLDS turns off the other phases
+		// until it's recorded (see record()).
+		void begin(ProfilePhase phase) {
+			if (phase == PHASE_WORLDS && std::this_thread::get_id() == mainThread) insideWorlds = true;
+		}
+
+		// Adds one timed run of a phase. Runs timed on other threads are left out (that happens when
+		// whole worlds step on the workers), and so are the ones the main thread times inside a round of
+		// worlds (it steps worlds of its own too, so how many would depend on --threads): the PHASE_WORLDS
+		// time around them still shows where it went.
+		void record(ProfilePhase phase, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) {
+			if (std::this_thread::get_id() != mainThread) return;
+			if (phase == PHASE_WORLDS) insideWorlds = false;
+			else if (insideWorlds) return;
+			long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+			generationNs[phase] += ns;
+			generationCalls[phase]++;
+			callHistogram[phase][bucketFor(ns)]++;
+			totalNs[phase] += ns;
+			totalCalls[phase]++;
+
+			if (!tracing) return;
+			if (traceUsed == trace.size()) { traceDropped++; return; }
+			TraceEvent &event = trace[traceUsed++];
+			event.phase = phase;
+			event.startNs = std::chrono::duration_cast<std::chrono::nanoseconds>(start - origin).count();
+			event.durationNs = ns;
+		}
+
+		void count(ProfileCounter counter, long long n) {
+			counters[counter].fetch_add(n, std::memory_order_relaxed);
+		}
+
+		// Closes off a round of generations (one per world, so more than one with --worlds): every phase's
+		// time for the round goes into its histogram as that many generations of the average time, and if
+		// report is given, a line with the round's times and counters is written to it.
+		void endGeneration(int generation, int worlds, std::ostream* report) {
+			if (report) {
+				*report << "gen " << generation;
+				if (worlds > 1) *report << "-" << generation + worlds - 1;
+			}
+			for (int p = 0; p < PHASE_COUNT; ++p) {
+				if (generationCalls[p] == 0) continue;
+				generationHistogram[p][bucketFor(generationNs[p] / worlds)] += worlds;
+				if (report) *report << " | " << PHASE_NAMES[p] << " " << generationNs[p] / 1e6 << "ms x" << generationCalls[p];
+				generationNs[p] = 0;
+				generationCalls[p] = 0;
+			}
+			for (int c = 0; c < COUNTER_COUNT; ++c) {
+				long long now = counters[c].load(std::memory_order_relaxed);
+				if (report) *report << " | " << COUNTER_NAMES[c] << " " << now - generationStart[c];
+				generationStart[c] = now;
+			}
+			if (report) *report << "\n";
+			generations += worlds;
+			rounds++;
+		}
+
+		// Writes the totals, the percentiles of every phase (per call and per generation) and the counters
+		void printReport(std::ostream &out) const {
+			out << "profile over " << generations << " generations";
+			if (rounds != generations) out << " (" << rounds << " rounds of worlds, per generation times are the round's split evenly)";
+			out << "\n";
+			for (int p = 0; p < PHASE_COUNT; ++p) {
+				if (totalCalls[p] == 0) continue;
+				out << "  " << PHASE_NAMES[p] << ": " << totalCalls[p] << " calls, " << totalNs[p] / 1e6 << " ms total"
+					<< " | per call p50 <" << percentile(callHistogram[p], 0.5) << "ns p99 <" << percentile(callHistogram[p], 0.99) << "ns"
+					<< " | per generation p50 <" << percentile(generationHistogram[p], 0.5) << "ns p99 <" << percentile(generationHistogram[p], 0.99) << "ns\n";
+			}
+			for (int c = 0; c < COUNTER_COUNT; ++c) {
+				out << "  " << COUNTER_NAMES[c] << ": " << counters[c].load(std::memory_order_relaxed) << "\n";
+			}
+			if (traceDropped > 0) out << "  trace events dropped: " << traceDropped << "\n";
+		}
+
+		// Saves the trace in the Chrome trace event format (open it in chrome://tracing or Perfetto)
+		bool writeTrace(const std::string &path) const {
+			std::ofstream file(path);
+			if (!file) return false;
+			file.setf(std::ios::fixed);
+			file.precision(3); // microseconds with nanoseconds after the point, even late in a long run
+			file << "{\"traceEvents\":[\n";
+			for (size_t e = 0; e < traceUsed; ++e) {
+				const TraceEvent &event = trace[e];
+				file << "{\"name\":\"" << PHASE_NAMES[event.phase] << "\",\"ph\":\"X\",\"pid\":1,\"tid\":1"
+					<< ",\"ts\":" << event.startNs / 1000.0 << ",\"dur\":" << event.durationNs / 1000.0 << "}"
+					<< (e + 1 < traceUsed ? ",\n" : "\n");
+			}
+			file << "],\"displayTimeUnit\":\"ms\"}\n";
+			return (bool)file;
+		}
+
+	private:
+		struct TraceEvent {
+			ProfilePhase phase;
+			long long startNs;    // since the profiler was created
+			long long durationNs;
+		};
+
+		static constexpr const char* PHASE_NAMES[PHASE_COUNT] = {
+			"generate", "step", "distance_field", "plan", "predict", "decide", "commit", "render", "train", "worlds"};
+		static constexpr const char* COUNTER_NAMES[COUNTER_COUNT] = {
+			"predictions", "cache_hits", "frontier_searches", "frontier_stalls", "step_allocations"};
+
+		std::chrono::steady_clock::time_point origin;
+		std::thread::id mainThread; // the only thread whose timers are kept
+		long long generationNs[PHASE_COUNT] = {};
+		long long generationCalls[PHASE_COUNT] = {};
+		long long totalNs[PHASE_COUNT] = {};
+		long long totalCalls[PHASE_COUNT] = {};
+		long long callHistogram[PHASE_COUNT][BUCKETS] = {};
+		long long generationHistogram[PHASE_COUNT][BUCKETS] = {};
+		std::atomic<long long> counters[COUNTER_COUNT];
+		long long generationStart[COUNTER_COUNT] = {}; // counter values when the generation started
+		int generations = 0;
+		int rounds = 0; // endGeneration() calls, fewer than generations with --worlds
+		std::vector<TraceEvent> trace;
+		size_t traceUsed = 0;
+		long long traceDropped = 0;
+		bool tracing = false;
+		bool insideWorlds = false; // a PHASE_WORLDS scope is open on the main thread
+
+		static int bucketFor(long long ns) {
+			int bucket = 0;
+			while (ns > 0 && bucket < BUCKETS - 1) { ns >>= 1; bucket++; }
+			return bucket;
+		}
+
+		// Upper end of the bucket that fraction q of the samples fall under
+		static long long percentile(const long long* histogram, double q) {
+			long long total = 0;
+			for (int b = 0; b < BUCKETS; ++b) total += histogram[b];
+			long long seen = 0;
+			for (int b = 0; b < BUCKETS; ++b) {
+				seen += histogram[b];
+				if (seen > 0 && seen >= q * total) return 1LL << b;
+			}
+			return 0;
+		}
+};
+
+constexpr const char* Profiler::PHASE_NAMES[PHASE_COUNT];
+constexpr const char* Profiler::COUNTER_NAMES[COUNTER_COUNT];
+
+Profiler profiler; // the one profiler everything reports to
+
+// Times the rest of the enclosing block as one run of a phase
+class ProfileScope {
+	public:
+		explicit ProfileScope(ProfilePhase phase) : phase(phase) {
+			profiler.begin(phase);
+			start = std::chrono::steady_clock::now();
+		}
+		~ProfileScope() { profiler.record(phase, start, std::chrono::steady_clock::now()); }
+	private:
+		ProfilePhase phase;
+		std::chrono::steady_clock::time_point start;
+};
+
+#define PROFILE_JOIN2(a, b) a##b
+#define PROFILE_JOIN(a, b) PROFILE_JOIN2(a, b)
+#define PROFILE_SCOPE(phase) ProfileScope PROFILE_JOIN(profileScope, __LINE__)(phase)
+#define PROFILE_COUNT(counter, n) profiler.count(counter, n)
+#define PROFILE_RECORD(phase, start, end) profiler.record(phase, start, end)
+#define PROFILE_END_GENERATION(generation, worlds, report) profiler.endGeneration(generation, worlds, report)
+#else
+#define PROFILE_SCOPE(phase) ((void)0)
+#define PROFILE_COUNT(counter, n) ((void)0)
+#define PROFILE_RECORD(phase, start, end) ((void)0)
+#define PROFILE_END_GENERATION(generation, worlds, report) ((void)0)
+#endif
+
+// ==========================================
+//              SIMD KERNELS
+// ==========================================
+// The neural network spends nearly all of its time in three small loops: a dot product
+// (one neuron's weights times its inputs), an axpy (y += a * x, used when adjusting weights)
+// and the sigmoid. Each set of kernels below does those three jobs, plus the float and int8 dot
+// products used by the reduced-precision network. The best set for this CPU is picked once at
+// startup, and the scalar set is kept as the reference to check against.
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CAI_X86_KERNELS 1
+#include <immintrin.h> // used for the SSE2 / AVX2 / AVX-512 intrinsics
+#endif
+
+const int KERNEL_BLOCK_ROWS = 4; // most rows the block kernels take at once
+
+struct Kernels {
+	const char* name;
+	double (*dot)(const double* a, const double* b, int n);     // returns sum of a[i] * b[i]
+	// out[r] = dot(a[r], b, n) for up to KERNEL_BLOCK_ROWS rows, added up in exactly the same order as dot
+	void (*dotRows)(const double* const* a, int rows, const double* b, int n, double* out);
+	void (*axpy)(double* y, const double* x, double a, int n);  // y[i] += a * x[i]
+	// axpy(y, x[r], a[r], n) for up to KERNEL_BLOCK_ROWS rows in turn, giving exactly what those calls would
+	void (*axpyRows)(double* y, const double* const* x, const double* a, int rows, int n);
+	void (*sigmoid)(double* values, int n);                     // values[i] = 1 / (1 + e^-values[i])
+	// sums[r][n] += in[r][i] * w[i * width + n] over every input i, for up to KERNEL_BLOCK_ROWS rows
+	void (*blockFloat)(const float* const* in, int rows, const float* w, int numInputs, int width, float* const* sums);
+	void (*blockInt8)(const uint8_t* const* in, int rows, const int8_t* w, int numInputs, int width, int32_t* const* sums); // every in[r][i] <= 127
+};
+
+// --- Scalar reference kernels ---
+double scalarDot(const double* a, const double* b, int n) {
+	double sum = 0.0;
+	for (int i = 0; i < n; ++i) sum += a[i] * b[i];
+	return sum;
+}
+
+// Every b[i] is loaded once for all ROWS rows (a full block goes through ROWS = KERNEL_BLOCK_ROWS,
+// anything less one row at a time)
+template <int ROWS>
+inline void scalarDotRowsOf(const double* const* a, const double* b, int n, double* out) {
+	double sum[ROWS];
+#pragma GCC unroll 4
+	for (int r = 0; r < ROWS; ++r) sum[r] = 0.0;
+	for (int i = 0; i < n; ++i) {
+#pragma GCC unroll 4
+		for (int r = 0; r < ROWS; ++r) sum[r] += a[r][i] * b[i];
+	}
+	for (int r = 0; r < ROWS; ++r) out[r] = sum[r];
+}
+
+void scalarDotRows(const double* const* a, int rows, const double* b, int n, double* out) {
+	if (rows == KERNEL_BLOCK_ROWS) { scalarDotRowsOf<KERNEL_BLOCK_ROWS>(a, b, n, out); return; }
+	for (int r = 0; r < rows; ++r) scalarDotRowsOf<1>(a + r, b, n, out + r);
+}
+
+void scalarAxpy(double* y, const double* x, double a, int n) {
+	for (int i = 0; i < n; ++i) y[i] += a * x[i];
+}
+
+// Every y[i] is loaded and stored once for all ROWS rows, the rows still get added in order
+template <int ROWS>
+inline void scalarAxpyRowsOf(double* y, const double* const* x, const double* a, int n) {
+	for (int i = 0; i < n; ++i) {
+		double v = y[i];
+#pragma GCC unroll 4
+		for (int r = 0; r < ROWS; ++r) v += a[r] * x[r][i];
+		y[i] = v;
+	}
+}
+
+void scalarAxpyRows(double* y, const double* const* x, const double* a, int rows, int n) {
+	if (rows == KERNEL_BLOCK_ROWS) { scalarAxpyRowsOf<KERNEL_BLOCK_ROWS>(y, x, a, n); return; }
+	for (int r = 0; r < rows; ++r) scalarAxpyRowsOf<1>(y, x + r, a + r, n);
+}
+
+void scalarSigmoid(double* values, int n) {
+	for (int i = 0; i < n; ++i) values[i] = 1 / (1 + exp(-values[i]));
+}
+
+// sums[r][n] += in[r][i] * w[i * width + n] for every input i, for rows r < rows. w holds the weights
+// input by input (see ReducedNetwork), so every weight that's loaded is used for all the rows at once.
+void scalarBlockFloat(const float* const* in, int rows, const float* w, int numInputs, int width, float* const* sums) {
+	for (int r = 0; r < rows; ++r) {
+		for (int i = 0; i < numInputs; ++i) {
+			for (int n = 0; n < width; ++n) sums[r][n] += in[r][i] * w[(size_t)i * width + n];
+		}
+	}
+}
+
+void scalarBlockInt8(const uint8_t* const* in, int rows, const int8_t* w, int numInputs, int width, int32_t* const* sums) {
+	for (int r = 0; r < rows; ++r) {
+		for (int i = 0; i < numInputs; ++i) {
+			for (int n = 0; n < width; ++n) sums[r][n] += in[r][i] * w[(size_t)i * width + n];
+		}
+	}
+}
+
+const Kernels scalarKernels = {"scalar", scalarDot, scalarDotRows, scalarAxpy, scalarAxpyRows, scalarSigmoid, scalarBlockFloat, scalarBlockInt8};
+
+#ifdef CAI_X86_KERNELS
+// The vector sigmoids work out e^-x as 2^n * e^r, where n = round(-x / ln2) and |r| <= ln2/2.
+// e^r comes from a degree 9 polynomial (error around 1e-11), and 2^n is built straight into the
+// exponent bits of the double. This is a lot cheaper than calling exp() for every lane.
+const double EXP_CLAMP = 708.0;             // e^708 still fits inside a double
+const double LOG2E = 1.4426950408889634;
+const double LN2_HI = 0.693145751953125;    // ln2 split in two so n * LN2_HI is exact
+const double LN2_LO = 1.4286068203094172e-06;
+const double EXP_POLY[10] = {1.0, 1.0, 1.0 / 2, 1.0 / 6, 1.0 / 24, 1.0 / 120, 1.0 / 720,
+                             1.0 / 5040, 1.0 / 40320, 1.0 / 362880};
+
+// --- SSE2 kernels (2 doubles at a time, always available on x86-64) ---
+__attribute__((target("sse2")))
+double sse2Dot(const double* a, const double* b, int n) {
+	__m128d acc = _mm_setzero_pd();
+	int i = 0;
+	for (; i + 2 <= n; i += 2) acc = _mm_add_pd(acc, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+	double lanes[2];
+	_mm_storeu_pd(lanes, acc);
+	double sum = lanes[0] + lanes[1];
+	for (; i < n; ++i) sum += a[i] * b[i];
+	return sum;
+}
+
+// The dotRows kernels keep one accumulator per row, laid out and added up like the dot kernel's, and
+// load every piece of b once for all ROWS rows (see scalarDotRows)
+template <int ROWS>
+__attribute__((target("sse2")))
+inline void sse2DotRowsOf(const double* const* a, const double* b, int n, double* out) {
+	__m128d acc[ROWS];
+#pragma GCC unroll 4
+	for (int r = 0; r < ROWS; ++r) acc[r] = _mm_setzero_pd();
+	int i = 0;
+	for (; i + 2 <= n; i += 2) {
+		__m128d vb = _mm_loadu_pd(b + i);
+#pragma GCC unroll 4
+		for (int r = 0; r < ROWS; ++r) acc[r] = _mm_add_pd(acc[r], _mm_mul_pd(_mm_loadu_pd(a[r] + i), vb));
+	}
+	for (int r = 0; r < ROWS; ++r) {
+		double lanes[2];
+		_mm_storeu_pd(lanes, acc[r]);
+		double sum = lanes[0] + lanes[1];
+		for (int j = i; j < n; ++j) sum += a[r][j] * b[j];
+		out[r] = sum;
+	}
+}
+
+__attribute__((target("sse2")))
+void sse2DotRows(const double* const* a, int rows, const double* b, int n, double* out) {
+	if (rows == KERNEL_BLOCK_ROWS) { sse2DotRowsOf<KERNEL_BLOCK_ROWS>(a, b, n, out); return; }
+	for (int r = 0; r < rows; ++r) sse2DotRowsOf<1>(a + r, b, n, out + r);
+}
+
+__attribute__((target("sse2")))
+void sse2Axpy(double* y, const double* x, double a, int n) {
+	__m128d va = _mm_set1_pd(a);
+	int i = 0;
+	for (; i + 2 <= n; i += 2) _mm_storeu_pd(y + i, _mm_add_pd(_mm_loadu_pd(y + i), _mm_mul_pd(va, _mm_loadu_pd(x + i))));
+	for (; i < n; ++i) y[i] += a * x[i];
+}
+
+// The axpyRows kernels do every row's step exactly like the axpy kernel, but keep y in a register
+// between the rows (see scalarAxpyRows)
+template <int ROWS>
+__attribute__((target("sse2")))
+inline void sse2AxpyRowsOf(double* y, const double* const* x, const double* a, int n) {
+	__m128d va[ROWS];
+#pragma GCC unroll 4
+	for (int r = 0; r < ROWS; ++r) va[r] = _mm_set1_pd(a[r]);
+	int i = 0;
+	for (; i + 2 <= n; i += 2) {
+		__m128d v = _mm_loadu_pd(y + i);
+#pragma GCC unroll 4
+		for (int r = 0; r < ROWS; ++r) v = _mm_add_pd(v, _mm_mul_pd(va[r], _mm_loadu_pd(x[r] + i)));
+		_mm_storeu_pd(y + i, v);
+	}
+	for (; i < n; ++i) {
+		for (int r = 0; r < ROWS; ++r) y[i] += a[r] * x[r][i];
+	}
+}
+
+__attribute__((target("sse2")))
+void sse2AxpyRows(double* y, const double* const* x, const double* a, int rows, int n) {
+	if (rows == KERNEL_BLOCK_ROWS) { sse2AxpyRowsOf<KERNEL_BLOCK_ROWS>(y, x, a, n); return; }
+	for (int r = 0; r < rows; ++r) sse2AxpyRowsOf<1>(y, x + r, a + r, n);
+}
+
+__attribute__((target("sse2")))
+void sse2Sigmoid(double* values, int n) {
+	for (int i = 0; i < n; i += 2) {
+		// a leftover last value goes through a small buffer, so every value is worked out the same way
+		// no matter where it sits in the array (batched and single predictions have to agree exactly)
+		double tail[2] = {0.0, 0.0};
+		double* v = values + i;
+		if (n - i < 2) { tail[0] = values[i]; v = tail; }
+
+		__m128d t = _mm_sub_pd(_mm_setzero_pd(), _mm_loadu_pd(v)); // t = -x
+		t = _mm_min_pd(_mm_max_pd(t, _mm_set1_pd(-EXP_CLAMP)), _mm_set1_pd(EXP_CLAMP));
+		__m128i k = _mm_cvtpd_epi32(_mm_mul_pd(t, _mm_set1_pd(LOG2E))); // rounds to nearest
+		__m128d kd = _mm_cvtepi32_pd(k);
+		__m128d r = _mm_sub_pd(_mm_sub_pd(t, _mm_mul_pd(kd, _mm_set1_pd(LN2_HI))), _mm_mul_pd(kd, _mm_set1_pd(LN2_LO)));
+		__m128d p = _mm_set1_pd(EXP_POLY[9]);
+		for (int c = 8; c >= 0; --c) p = _mm_add_pd(_mm_mul_pd(p, r), _mm_set1_pd(EXP_POLY[c]));
+		__m128i bits = _mm_slli_epi64(_mm_unpacklo_epi32(_mm_add_epi32(k, _mm_set1_epi32(1023)), _mm_setzero_si128()), 52);
+		__m128d e = _mm_mul_pd(p, _mm_castsi128_pd(bits)); // e^-x
+		_mm_storeu_pd(v, _mm_div_pd(_mm_set1_pd(1.0), _mm_add_pd(_mm_set1_pd(1.0), e)));
+		if (v == tail) values[i] = tail[0];
+	}
+}
+
+
+// The block kernels keep ROWS rows x a few SIMD registers of neurons in registers, and walk the
+// inputs once for each group of neurons. A full block goes through the ROWS = KERNEL_BLOCK_ROWS
+// version, anything less one row at a time.
+template <int ROWS>
+__attribute__((target("sse2")))
+inline void sse2BlockFloatRows(const float* const* in, const float* w, int numInputs, int width, float* const* sums) {
+	int n = 0;
+	for (; n + 8 <= width; n += 8) {
+		__m128 acc[ROWS][2];
+		#pragma GCC unroll 4
+		for (int r = 0; r < ROWS; ++r) { acc[r][0] = _mm_loadu_ps(sums[r] + n); acc[r][1] = _mm_loadu_ps(sums[r] + n + 4); }
+		const float* wi = w + n;
+		for (int i = 0; i < numInputs; ++i, wi += width) {
+			__m128 w0 = _mm_loadu_ps(wi), w1 = _mm_loadu_ps(wi + 4);
+			#pragma GCC unroll 4
+			for (int r = 0; r < ROWS; ++r) {
+				__m128 x = _mm_set1_ps(in[r][i]);
+				acc[r][0] = _mm_add_ps(acc[r][0], _mm_mul_ps(x, w0));
+				acc[r][1] = _mm_add_ps(acc[r][1], _mm_mul_ps(x, w1));
+			}
+		}
+		#pragma GCC unroll 4
+		for (int r = 0; r < ROWS; ++r) { _mm_storeu_ps(sums[r] + n, acc[r][0]); _mm_storeu_ps(sums[r] + n + 4, acc[r][1]); }
+	}
+	for (; n + 4 <= width; n += 4) {
+		__m128 acc[ROWS];
+		#pragma GCC unroll 4
+		for (int r = 0; r < ROWS; ++r) acc[r] = _mm_loadu_ps(sums[r] + n);
+		const float* wi = w + n;
+		for (int i = 0; i < numInputs; ++i, wi += width) {
+			__m128 w0 = _mm_loadu_ps(wi);
+			#pragma GCC unroll 4
+			for (int r = 0; r < ROWS; ++r) acc[r] = _mm_add_ps(acc[r], _mm_mul_ps(_mm_set1_ps(in[r][i]), w0));
+		}
+		#pragma GCC unroll 4
+		for (int r = 0; r < ROWS; ++r) _mm_storeu_ps(sums[r] + n, acc[r]);
+	}
+	for (; n < width; ++n) {
+		#pragma GCC unroll 4
+		for (int r = 0; r < ROWS; ++r) {
+			for (int i = 0; i < numInputs; ++i) sums[r][n] += in[r][i] * w[(size_t)i * width + n];
+		}
+	}
+}
+
+__attribute__((target("sse2")))
+void sse2BlockFloat(const float* const* in, int rows, const float* w, int numInputs, int width, float* const* sums) {
+	if (rows == KERNEL_BLOCK_ROWS) { sse2BlockFloatRows<KERNEL_BLOCK_ROWS>(in, w, numInputs, width, sums); return; }
+	for (int r = 0; r < rows; ++r) sse2BlockFloatRows<1>(in + r, w, numInputs, width, sums + r);
+}
+
+// 8 weights at a time, sign-extended to 16 bits. An activation byte times a weight always fits in
+// 16 bits (127 * 127), so _mm_mullo_epi16 does the multiplies and only the products get widened.
+template <int ROWS>
+__attribute__((target("sse2")))
+inline void sse2BlockInt8Rows(const uint8_t* const* in, const int8_t* w, int numInputs, int width, int32_t* const* sums) {
+	int n = 0;
+	for (; n + 8 <= width; n += 8) {
+		__m128i acc[ROWS][2];
+		#pragma GCC unroll 4
+		for (int r = 0; r < ROWS; ++r) {
+			acc[r][0] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sums[r] + n));
+			acc[r][1] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sums[r] + n + 4));
+		}
+		const int8_t* wi = w + n;
+		for (int i = 0; i < numInputs; ++i, wi += width) {
+			__m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(wi));
+			__m128i w16 = _mm_srai_epi16(_mm_unpacklo_epi8(bytes, bytes), 8);
+			#pragma GCC unroll 4
+			for (int r = 0; r < ROWS; ++r) {
+				__m128i p = _mm_mullo_epi16(w16, _mm_set1_epi16((short)in[r][i]));
+				acc[r][0] = _mm_add_epi32(acc[r][0], _mm_srai_epi32(_mm_unpacklo_epi16(p, p), 16));
+				acc[r][1] = _mm_add_epi32(acc[r][1], _mm_srai_epi32(_mm_unpackhi_epi16(p, p), 16));
+			}
+		}
+		#pragma GCC unroll 4
+		for (int r = 0; r < ROWS; ++r) {
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(sums[r] + n), acc[r][0]);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(sums[r] + n + 4), acc[r][1]);
+		}
+	}
+	for (; n < width; ++n) {
+		#pragma GCC unroll 4
+		for (int r = 0; r < ROWS; ++r) {
+			for (int i = 0; i < numInputs; ++i) sums[r][n] += in[r][i] * w[(size_t)i * width + n];
+		}
+	}
+}
+
+__attribute__((target("sse2")))
+void sse2BlockInt8(const uint8_t* const* in, int rows, const int8_t* w, int numInputs, int width, int32_t* const* sums) {
+	if (rows == KERNEL_BLOCK_ROWS) { sse2BlockInt8Rows<KERNEL_BLOCK_ROWS>(in, w, numInputs, width, sums); return; }
+	for (int r = 0; r < rows; ++r) sse2BlockInt8Rows<1>(in + r, w, numInputs, width, sums + r);
+}
+
+// --- AVX2 + FMA kernels (4 doubles at a time) ---
+__attribute__((target("avx2,fma")))
+double avx2Dot(const double* a, const double* b, int n) {
+	__m256d acc = _mm256_setzero_pd();
+	int i = 0;
+	for (; i + 4 <= n; i += 4) acc = _mm256_fmadd_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), acc);
+	__m128d half = _mm_add_pd(_mm256_castpd256_pd128(acc), _mm256_extractf128_pd(acc, 1));
+	double sum = _mm_cvtsd_f64(_mm_add_sd(half, _mm_unpackhi_pd(half, half)));
+	for (; i < n; ++i) sum += a[i] * b[i];
+	return sum;
+}
+
+template <int ROWS>
+__attribute__((target("avx2,fma")))
+inline void avx2DotRowsOf(const double* const* a, const double* b, int n, double* out) {
+	__m256d acc[ROWS];
+#pragma GCC unroll 4
+	for (int r = 0; r < ROWS; ++r) acc[r] = _mm256_setzero_pd();
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m256d vb = _mm256_loadu_pd(b + i);
+#pragma GCC unroll 4
+		for (int r = 0; r < ROWS; ++r) acc[r] = _mm256_fmadd_pd(_mm256_loadu_pd(a[r] + i), vb, acc[r]);
+	}
+	for (int r = 0; r < ROWS; ++r) {
+		__m128d half = _mm_add_pd(_mm256_castpd256_pd128(acc[r]), _mm256_extractf128_pd(acc[r], 1));
+		double sum = _mm_cvtsd_f64(_mm_add_sd(half, _mm_unpackhi_pd(half, half)));
+		for (int j = i; j < n; ++j) sum += a[r][j] * b[j];
+		out[r] = sum;
+	}
+}
+
+__attribute__((target("avx2,fma")))
+void avx2DotRows(const double* const* a, int rows, const double* b, int n, double* out) {
+	if (rows == KERNEL_BLOCK_ROWS) { avx2DotRowsOf<KERNEL_BLOCK_ROWS>(a, b, n, out); return; }
+	for (int r = 0; r < rows; ++r) avx2DotRowsOf<1>(a + r, b, n, out + r);
+}
+
+__attribute__((target("avx2,fma")))
+void avx2Axpy(double* y, const double* x, double a, int n) {
+	__m256d va = _mm256_set1_pd(a);
+	int i = 0;
+	for (; i + 4 <= n; i += 4) _mm256_storeu_pd(y + i, _mm256_fmadd_pd(va, _mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+	for (; i < n; ++i) y[i] += a * x[i];
+}
+
+template <int ROWS>
+__attribute__((target("avx2,fma")))
+inline void avx2AxpyRowsOf(double* y, const double* const* x, const double* a, int n) {
+	__m256d va[ROWS];
+#pragma GCC unroll 4
+	for (int r = 0; r < ROWS; ++r) va[r] = _mm256_set1_pd(a[r]);
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m256d v = _mm256_loadu_pd(y + i);
+#pragma GCC unroll 4
+		for (int r = 0; r < ROWS; ++r) v = _mm256_fmadd_pd(va[r], _mm256_loadu_pd(x[r] + i), v);
+		_mm256_storeu_pd(y + i, v);
+	}
+	for (; i < n; ++i) {
+		for (int r = 0; r < ROWS; ++r) y[i] += a[r] * x[r][i];
+	}
+}
+
+__attribute__((target("avx2,fma")))
+void avx2AxpyRows(double* y, const double* const* x, const double* a, int rows, int n) {
+	if (rows == KERNEL_BLOCK_ROWS) { avx2AxpyRowsOf<KERNEL_BLOCK_ROWS>(y, x, a, n); return; }
+	for (int r = 0; r < rows; ++r) avx2AxpyRowsOf<1>(y, x + r, a + r, n);
+}
+
+__attribute__((target("avx2,fma")))
+void avx2Sigmoid(double* values, int n) {
+	for (int i = 0; i < n; i += 4) {
+		// the last few values go through a small buffer (see sse2Sigmoid)
+		double tail[4] = {0.0, 0.0, 0.0, 0.0};
+		double* v = values + i;
+		int left = n - i;
+		if (left < 4) {
+			for (int j = 0; j < left; ++j) tail[j] = values[i + j];
+			v = tail;
+		}
+
+		__m256d t = _mm256_sub_pd(_mm256_setzero_pd(), _mm256_loadu_pd(v)); // t = -x
+		t = _mm256_min_pd(_mm256_max_pd(t, _mm256_set1_pd(-EXP_CLAMP)), _mm256_set1_pd(EXP_CLAMP));
+		__m128i k = _mm256_cvtpd_epi32(_mm256_mul_pd(t, _mm256_set1_pd(LOG2E))); // rounds to nearest
+		__m256d kd = _mm256_cvtepi32_pd(k);
+		__m256d r = _mm256_fnmadd_pd(kd, _mm256_set1_pd(LN2_HI), t);
+		r = _mm256_fnmadd_pd(kd, _mm256_set1_pd(LN2_LO), r);
+		__m256d p = _mm256_set1_pd(EXP_POLY[9]);
+		for (int c = 8; c >= 0; --c) p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(EXP_POLY[c]));
+		__m256i bits = _mm256_slli_epi64(_mm256_cvtepu32_epi64(_mm_add_epi32(k, _mm_set1_epi32(1023))), 52);
+		__m256d e = _mm256_mul_pd(p, _mm256_castsi256_pd(bits)); // e^-x
+		__m256d one = _mm256_set1_pd(1.0);
+		_mm256_storeu_pd(v, _mm256_div_pd(one, _mm256_add_pd(one, e)));
+		if (v == tail) {
+			for (int j = 0; j < left; ++j) values[i + j] = tail[j];
+		}
+	}
+}
+
+
+// 16 neurons at a time, then 8, then 4 (the output layer only has 4)
+template <int ROWS>
+__attribute__((target("avx2,fma")))
+inline void avx2BlockFloatRows(const float* const* in, const float* w, int numInputs, int width, float* const* sums) {
+	int n = 0;
+	for (; n + 16 <= width; n += 16) {
+		__m256 acc[ROWS][2];
+		#pragma GCC unroll 4
+		for (int r = 0; r < ROWS; ++r) { acc[r][0] = _mm256_loadu_ps(sums[r] + n); acc[r][1] = _mm256_loadu_ps(sums[r] + n + 8); }
+		const float* wi = w + n;
+		for (int i = 0; i < numInputs; ++i, wi += width) {
+			__m256 w0 = _mm256_loadu_ps(wi), w1 = _mm256_loadu_ps(wi + 8);
+			#pragma GCC unroll 4
+			for (int r = 0; r < ROWS; ++r) {
+				__m256 x = _mm256_broadcast_ss(in[r] + i);
+				acc[r][0] = _mm256_fmadd_ps(x, w0, acc[r][0]);
+				acc[r][1] = _mm256_fmadd_ps(x, w1, acc[r][1]);
+			}
+		}
+		#pragma GCC unroll 4
+		for (int r = 0; r < ROWS; ++r) { _mm256_storeu_ps(sums[r] + n, acc[r][0]); _mm256_storeu_ps(sums[r] + n + 8, acc[r][1]); }
+	}
+	for (; n + 8 <= width; n += 8) {
+		__m256 acc[ROWS];
+		#pragma GCC unroll 4
+		for (int r = 0; r < ROWS; ++r) acc[r] = _mm256_loadu_ps(sums[r] + n);
+		const float* wi = w + n;
+		for (int i = 0; i < numInputs; ++i, wi += width) {
+			__m256 w0 = _mm256_loadu_ps(wi);
+			#pragma GCC unroll 4
+			for (int r = 0; r < ROWS; ++r) acc[r] = _mm256_fmadd_ps(_mm256_broadcast_ss(in[r] + i), w0, acc[r]);
+		}
+		#pragma GCC unroll 4
+		for (int r = 0; r < ROWS; ++r) _mm256_storeu_ps(sums[r] + n, acc[r]);
+	}
+	for (; n + 4 <= width; n += 4) {
+		__m128 acc[ROWS];
+		#pragma GCC unroll 4
+		for (int r = 0; r < ROWS; ++r) acc[r] = _mm_loadu_ps(sums[r] + n);
+		const float* wi = w + n;
+		for (int i = 0; i < numInputs; ++i, wi += width) {
+			__m128 w0 = _mm_loadu_ps(wi);
+			#pragma GCC unroll 4
+			for (int r = 0; r < ROWS; ++r) acc[r] = _mm_fmadd_ps(_mm_broadcast_ss(in[r] + i), w0, acc[r]);
+		}
+		#pragma GCC unroll 4
+		for (int r = 0; r < ROWS; ++r) _mm_storeu_ps(sums[r] + n, acc[r]);
+	}
+	for (; n < width; ++n) {
+		#pragma GCC unroll 4
+		for (int r = 0; r < ROWS; ++r) {
+			for (int i = 0; i < numInputs; ++i) sums[r][n] += in[r][i] * w[(size_t)i * width + n];
+		}
+	}
+}
+
+__attribute__((target("avx2,fma")))
+void avx2BlockFloat(const float* const* in, int rows, const float* w, int numInputs, int width, float* const* sums) {
+	if (rows == KERNEL_BLOCK_ROWS) { avx2BlockFloatRows<KERNEL_BLOCK_ROWS>(in, w, numInputs, width, sums); return; }
+	for (int r = 0; r < rows; ++r) avx2BlockFloatRows<1>(in + r, w, numInputs, width, sums + r);
+}
+
+// 16 weights at a time, two inputs at once: the two inputs' weights are widened to 16 bits and
+// interleaved, so _mm256_madd_epi16 multiplies both and adds them up per neuron. The interleave works
+// inside each 128-bit half, so the sums come out as neurons 0-3, 8-11 | 4-7, 12-15 and get put back in
+// order when they're stored. Then 8 at a time sign-extended straight to 32 bits, then 4.
+template <int ROWS>
+__attribute__((target("avx2,fma")))
+inline void avx2BlockInt8Rows(const uint8_t* const* in, const int8_t* w, int numInputs, int width, int32_t* const* sums) {
+	int n = 0;
+	for (; n + 16 <= width; n += 16) {
+		__m256i lo[ROWS], hi[ROWS]; // (the order the madds leave them in, see above)
+#pragma GCC unroll 4
+		for (int r = 0; r < ROWS; ++r) {
+			__m256i first = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(sums[r] + n));
+			__m256i second = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(sums[r] + n + 8));
+			lo[r] = _mm256_permute2x128_si256(first, second, 0x20);
+			hi[r] = _mm256_permute2x128_si256(first, second, 0x31);
+		}
+		const int8_t* wi = w + n;
+		for (int i = 0; i < numInputs; i += 2, wi += 2 * width) {
+			__m256i w0 = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(wi)));
+			__m256i w1 = (i + 1 < numInputs) ? _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(wi + width))) : _mm256_setzero_si256();
+			__m256i pairsLo = _mm256_unpacklo_epi16(w0, w1);
+			__m256i pairsHi = _mm256_unpackhi_epi16(w0, w1);
+#pragma GCC unroll 4
+			for (int r = 0; r < ROWS; ++r) {
+				int second = (i + 1 < numInputs) ? in[r][i + 1] : 0;
+				__m256i x = _mm256_set1_epi32(in[r][i] | (second << 16));
+				lo[r] = _mm256_add_epi32(lo[r], _mm256_madd_epi16(pairsLo, x));
+				hi[r] = _mm256_add_epi32(hi[r], _mm256_madd_epi16(pairsHi, x));
+			}
+		}
+#pragma GCC unroll 4
+		for (int r = 0; r < ROWS; ++r) {
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(sums[r] + n), _mm256_permute2x128_si256(lo[r], hi[r], 0x20));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(sums[r] + n + 8), _mm256_permute2x128_si256(lo[r], hi[r], 0x31));
+		}
+	}
+	for (; n + 8 <= width; n += 8) {
+		__m256i acc[ROWS];
+		#pragma GCC unroll 4
+		for (int r = 0; r < ROWS; ++r) acc[r] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(sums[r] + n));
+		const int8_t* wi = w + n;
+		for (int i = 0; i < numInputs; ++i, wi += width) {
+			__m256i w32 = _mm256_cvtepi8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(wi)));
+			#pragma GCC unroll 4
+			for (int r = 0; r < ROWS; ++r) acc[r] = _mm256_add_epi32(acc[r], _mm256_mullo_epi32(w32, _mm256_set1_epi32(in[r][i])));
+		}
+		#pragma GCC unroll 4
+		for (int r = 0; r < ROWS; ++r) _mm256_storeu_si256(reinterpret_cast<__m256i*>(sums[r] + n), acc[r]);
+	}
+	for (; n + 4 <= width; n += 4) {
+		__m128i acc[ROWS];
+		#pragma GCC unroll 4
+		for (int r = 0; r < ROWS; ++r) acc[r] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sums[r] + n));
+		const int8_t* wi = w + n;
+		for (int i = 0; i < numInputs; ++i, wi += width) {
+			int32_t bytes;
+			memcpy(&bytes, wi, sizeof(bytes));
+			__m128i w32 = _mm_cvtepi8_epi32(_mm_cvtsi32_si128(bytes));
+			#pragma GCC unroll 4
+			for (int r = 0; r < ROWS; ++r) acc[r] = _mm_add_epi32(acc[r], _mm_mullo_epi32(w32, _mm_set1_epi32(in[r][i])));
+		}
+		#pragma GCC unroll 4
+		for (int r = 0; r < ROWS; ++r) _mm_storeu_si128(reinterpret_cast<__m128i*>(sums[r] + n), acc[r]);
+	}
+	for (; n < width; ++n) {
+		#pragma GCC unroll 4
+		for (int r = 0; r < ROWS; ++r) {
+			for (int i = 0; i < numInputs; ++i) sums[r][n] += in[r][i] * w[(size_t)i * width + n];
+		}
+	}
+}
+
+__attribute__((target("avx2,fma")))
+void avx2BlockInt8(const uint8_t* const* in, int rows, const int8_t* w, int numInputs, int width, int32_t* const* sums) {
+	if (rows == KERNEL_BLOCK_ROWS) { avx2BlockInt8Rows<KERNEL_BLOCK_ROWS>(in, w, numInputs, width, sums); return; }
+	for (int r = 0; r < rows; ++r) avx2BlockInt8Rows<1>(in + r, w, numInputs, width, sums + r);
+}
+
+// --- AVX-512 kernels (8 doubles at a time) ---
+// (GCC's own AVX-512 headers trip -Wuninitialized with their "undefined" vectors, so mute that here)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+__attribute__((target("avx512f")))
+double avx512Dot(const double* a, const double* b, int n) {
+	__m512d acc = _mm512_setzero_pd();
+	int i = 0;
+	for (; i + 8 <= n; i += 8) acc = _mm512_fmadd_pd(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i), acc);
+	if (i < n) {
+		// masked load handles the last few weights without a scalar loop
+		__mmask8 tail = (__mmask8)((1u << (n - i)) - 1);
+		acc = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(tail, a + i), _mm512_maskz_loadu_pd(tail, b + i), acc);
+	}
+	return _mm512_reduce_add_pd(acc);
+}
+
+template <int ROWS>
+__attribute__((target("avx512f")))
+inline void avx512DotRowsOf(const double* const* a, const double* b, int n, double* out) {
+	__m512d acc[ROWS];
+#pragma GCC unroll 4
+	for (int r = 0; r < ROWS; ++r) acc[r] = _mm512_setzero_pd();
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m512d vb = _mm512_loadu_pd(b + i);
+#pragma GCC unroll 4
+		for (int r = 0; r < ROWS; ++r) acc[r] = _mm512_fmadd_pd(_mm512_loadu_pd(a[r] + i), vb, acc[r]);
+	}
+	if (i < n) {
+		__mmask8 tail = (__mmask8)((1u << (n - i)) - 1);
+		__m512d vb = _mm512_maskz_loadu_pd(tail, b + i);
+#pragma GCC unroll 4
+		for (int r = 0; r < ROWS; ++r) acc[r] = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(tail, a[r] + i), vb, acc[r]);
+	}
+	for (int r = 0; r < ROWS; ++r) out[r] = _mm512_reduce_add_pd(acc[r]);
+}
+
+__attribute__((target("avx512f")))
+void avx512DotRows(const double* const* a, int rows, const double* b, int n, double* out) {
+	if (rows == KERNEL_BLOCK_ROWS) { avx512DotRowsOf<KERNEL_BLOCK_ROWS>(a, b, n, out); return; }
+	for (int r = 0; r < rows; ++r) avx512DotRowsOf<1>(a + r, b, n, out + r);
+}
+
+__attribute__((target("avx512f")))
+void avx512Axpy(double* y, const double* x, double a, int n) {
+	__m512d va = _mm512_set1_pd(a);
+	int i = 0;
+	for (; i + 8 <= n; i += 8) _mm512_storeu_pd(y + i, _mm512_fmadd_pd(va, _mm512_loadu_pd(x + i), _mm512_loadu_pd(y + i)));
+	if (i < n) {
+		__mmask8 tail = (__mmask8)((1u << (n - i)) - 1);
+		_mm512_mask_storeu_pd(y + i, tail, _mm512_fmadd_pd(va, _mm512_maskz_loadu_pd(tail, x + i), _mm512_maskz_loadu_pd(tail, y + i)));
+	}
+}
+
+template <int ROWS>
+__attribute__((target("avx512f")))
+inline void avx512AxpyRowsOf(double* y, const double* const* x, const double* a, int n) {
+	__m512d va[ROWS];
+#pragma GCC unroll 4
+	for (int r = 0; r < ROWS; ++r) va[r] = _mm512_set1_pd(a[r]);
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m512d v = _mm512_loadu_pd(y + i);
+#pragma GCC unroll 4
+		for (int r = 0; r < ROWS; ++r) v = _mm512_fmadd_pd(va[r], _mm512_loadu_pd(x[r] + i), v);
+		_mm512_storeu_pd(y + i, v);
+	}
+	if (i < n) {
+		__mmask8 tail = (__mmask8)((1u << (n - i)) - 1);
+		__m512d v = _mm512_maskz_loadu_pd(tail, y + i);
+#pragma GCC unroll 4
+		for (int r = 0; r < ROWS; ++r) v = _mm512_fmadd_pd(va[r], _mm512_maskz_loadu_pd(tail, x[r] + i), v);
+		_mm512_mask_storeu_pd(y + i, tail, v);
+	}
+}
+
+__attribute__((target("avx512f")))
+void avx512AxpyRows(double* y, const double* const* x, const double* a, int rows, int n) {
+	if (rows == KERNEL_BLOCK_ROWS) { avx512AxpyRowsOf<KERNEL_BLOCK_ROWS>(y, x, a, n); return; }
+	for (int r = 0; r < rows; ++r) avx512AxpyRowsOf<1>(y, x + r, a + r, n);
+}
+
+__attribute__((target("avx512f")))
+void avx512Sigmoid(double* values, int n) {
+	for (int i = 0; i < n; i += 8) {
+		__mmask8 lanes = (n - i >= 8) ? (__mmask8)0xFF : (__mmask8)((1u << (n - i)) - 1);
+		__m512d t = _mm512_sub_pd(_mm512_setzero_pd(), _mm512_maskz_loadu_pd(lanes, values + i)); // t = -x
+		t = _mm512_min_pd(_mm512_max_pd(t, _mm512_set1_pd(-EXP_CLAMP)), _mm512_set1_pd(EXP_CLAMP));
+		__m512d kd = _mm512_roundscale_pd(_mm512_mul_pd(t, _mm512_set1_pd(LOG2E)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+		__m512d r = _mm512_fnmadd_pd(kd, _mm512_set1_pd(LN2_HI), t);
+		r = _mm512_fnmadd_pd(kd, _mm512_set1_pd(LN2_LO), r);
+		__m512d p = _mm512_set1_pd(EXP_POLY[9]);
+		for (int c = 8; c >= 0; --c) p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(EXP_POLY[c]));
+		__m512d e = _mm512_scalef_pd(p, kd); // e^-x = e^r * 2^n
+		__m512d one = _mm512_set1_pd(1.0);
+		_mm512_mask_storeu_pd(values + i, lanes, _mm512_div_pd(one, _mm512_add_pd(one, e)));
+	}
+}
+
+#pragma GCC diagnostic pop
+
+const Kernels sse2Kernels = {"sse2", sse2Dot, sse2DotRows, sse2Axpy, sse2AxpyRows, sse2Sigmoid, sse2BlockFloat, sse2BlockInt8};
+const Kernels avx2Kernels = {"avx2", avx2Dot, avx2DotRows, avx2Axpy, avx2AxpyRows, avx2Sigmoid, avx2BlockFloat, avx2BlockInt8};
+// (plain AVX-512F has no byte multiplies, so the int8 block kernel is the AVX2 one. So is the float
+// one: the layers here are at most a few hundred neurons wide, and 16 at a time already keeps it busy)
+const Kernels avx512Kernels = {"avx512", avx512Dot, avx512DotRows, avx512Axpy, avx512AxpyRows, avx512Sigmoid, avx2BlockFloat, avx2BlockInt8};
+#endif
+
+const Kernels* kernels = &scalarKernels; // the kernels used by the neural network, set by selectKernels()
+
+// Picks the kernels to use. "auto" takes the widest set this CPU supports, otherwise the named
+// set is used (as long as the CPU supports it). Returns false if the name isn't usable here.
+bool selectKernels(const std::string& name) {
+	const Kernels* best = &scalarKernels;
+#ifdef CAI_X86_KERNELS
+	__builtin_cpu_init();
+	const Kernels* available[3] = {&sse2Kernels, nullptr, nullptr};
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) available[1] = &avx2Kernels;
+	if (__builtin_cpu_supports("avx512f")) available[2] = &avx512Kernels;
+	for (const Kernels* k : available) {
+		if (!k) continue;
+		if (k->name == name) { kernels = k; return true; }
+		best = k;
+	}
+#endif
+	if (name == "scalar") { kernels = &scalarKernels; return true; }
+	if (name == "auto") { kernels = best; return true; }
+	return false;
+}
+
+// Compares the selected kernels against the scalar reference on random data.
+// Returns the largest difference found (dot products are compared relative to their size).
+double verifyKernels() {
+	const int MAX_N = 67; // odd sizes so every tail path gets used
+	double a[MAX_N], b[MAX_N], y1[MAX_N], y2[MAX_N];
+	double worst = 0.0;
+	for (int n = 1; n <= MAX_N; ++n) {
+		for (int i = 0; i < n; ++i) {
+			a[i] = ((double)rand() / RAND_MAX) * 2.0 - 1.0;
+			b[i] = ((double)rand() / RAND_MAX) * 2.0 - 1.0;
+			y1[i] = y2[i] = ((double)rand() / RAND_MAX) * 40.0 - 20.0; // covers the whole sigmoid curve
+		}
+
+		double dotDiff = fabs(kernels->dot(a, b, n) - scalarDot(a, b, n)) / n;
+		if (dotDiff > worst) worst = dotDiff;
+
+		// dotRows has to give exactly what dot gives (batched and single predictions have to agree),
+		// so any difference counts as a difference of 1. The rows are a, b, y1 and y2.
+		const double* rowsIn[KERNEL_BLOCK_ROWS] = {a, b, y1, y2};
+		for (int rows = 1; rows <= KERNEL_BLOCK_ROWS; ++rows) {
+			double out[KERNEL_BLOCK_ROWS];
+			kernels->dotRows(rowsIn, rows, b, n, out);
+			for (int r = 0; r < rows; ++r) {
+				if (out[r] != kernels->dot(rowsIn[r], b, n)) worst = 1.0;
+			}
+		}
+
+		// same for axpyRows against axpy, one row after another
+		const double steps[KERNEL_BLOCK_ROWS] = {0.37, -1.25, 0.5, 2.0};
+		for (int rows = 1; rows <= KERNEL_BLOCK_ROWS; ++rows) {
+			double blocked[MAX_N], oneByOne[MAX_N];
+			for (int i = 0; i < n; ++i) blocked[i] = oneByOne[i] = y1[i];
+			kernels->axpyRows(blocked, rowsIn, steps, rows, n);
+			for (int r = 0; r < rows; ++r) kernels->axpy(oneByOne, rowsIn[r], steps[r], n);
+			for (int i = 0; i < n; ++i) {
+				if (blocked[i] != oneByOne[i]) worst = 1.0;
+			}
+		}
+
+		scalarAxpy(y1, a, 0.37, n);
+		kernels->axpy(y2, a, 0.37, n);
+		scalarSigmoid(y1, n);
+		kernels->sigmoid(y2, n);
+		for (int i = 0; i < n; ++i) {
+			if (fabs(y1[i] - y2[i]) > worst) worst = fabs(y1[i] - y2[i]);
+		}
+	}
+	return worst;
+}
+
+// Same check for the float and int8 block kernels, over 1 to KERNEL_BLOCK_ROWS rows and every width
+// up to MAX_WIDTH (so every tile size and tail gets used). Returns the largest float difference
+// (relative to the number of inputs); the int8 ones have to match exactly, so any difference there
+// counts as a difference of 1.
+double verifyReducedKernels() {
+	const int MAX_INPUTS = 5; // odd and even counts, the AVX2 int8 kernel takes the inputs in pairs
+	const int MAX_WIDTH = 40;
+	float weights[MAX_INPUTS * MAX_WIDTH], inputs[KERNEL_BLOCK_ROWS][MAX_INPUTS];
+	int8_t weightBytes[MAX_INPUTS * MAX_WIDTH];
+	uint8_t codes[KERNEL_BLOCK_ROWS][MAX_INPUTS];
+	float sums1[KERNEL_BLOCK_ROWS][MAX_WIDTH], sums2[KERNEL_BLOCK_ROWS][MAX_WIDTH];
+	int32_t accs1[KERNEL_BLOCK_ROWS][MAX_WIDTH], accs2[KERNEL_BLOCK_ROWS][MAX_WIDTH];
+	double worst = 0.0;
+	for (int numInputs = 1; numInputs <= MAX_INPUTS; ++numInputs) {
+		for (int width = 1; width <= MAX_WIDTH; ++width) {
+			for (int i = 0; i < numInputs * width; ++i) {
+				weights[i] = ((float)rand() / RAND_MAX) * 2.0f - 1.0f;
+				weightBytes[i] = (int8_t)(rand() % 255 - 127);
+			}
+			for (int rows = 1; rows <= KERNEL_BLOCK_ROWS; ++rows) {
+				const float* in[KERNEL_BLOCK_ROWS];
+				const uint8_t* inCodes[KERNEL_BLOCK_ROWS];
+				float* s1[KERNEL_BLOCK_ROWS];
+				float* s2[KERNEL_BLOCK_ROWS];
+				int32_t* a1[KERNEL_BLOCK_ROWS];
+				int32_t* a2[KERNEL_BLOCK_ROWS];
+				for (int r = 0; r < rows; ++r) {
+					for (int i = 0; i < numInputs; ++i) {
+						inputs[r][i] = ((float)rand() / RAND_MAX) * 2.0f - 1.0f;
+						codes[r][i] = (uint8_t)(rand() % 128);
+					}
+					for (int n = 0; n < width; ++n) {
+						sums1[r][n] = sums2[r][n] = (float)n / MAX_WIDTH; // the kernels add to what's there (like a bias)
+						accs1[r][n] = accs2[r][n] = n;
+					}
+					in[r] = inputs[r]; inCodes[r] = codes[r];
+					s1[r] = sums1[r]; s2[r] = sums2[r]; a1[r] = accs1[r]; a2[r] = accs2[r];
+				}
+				scalarBlockFloat(in, rows, weights, numInputs, width, s1);
+				kernels->blockFloat(in, rows, weights, numInputs, width, s2);
+				scalarBlockInt8(inCodes, rows, weightBytes, numInputs, width, a1);
+				kernels->blockInt8(inCodes, rows, weightBytes, numInputs, width, a2);
+				for (int r = 0; r < rows; ++r) {
+					for (int n = 0; n < width; ++n) {
+						double diff = fabs((double)sums1[r][n] - sums2[r][n]) / numInputs;
+						if (diff > worst) worst = diff;
+						if (accs1[r][n] != accs2[r][n]) worst = 1.0;
+					}
+				}
+			}
+		}
+	}
+	return worst;
+}
+
+// ==========================================
+//               THREAD POOL
+// ==========================================
+// A fixed set of worker threads that split a loop between them. The loop [0, count) is cut into
+// one contiguous chunk per thread (the calling thread takes chunk 0), so which thread handles which
+// index only depends on count and the number of threads. Nothing is allocated per call.
+// parallelForEach() is for loops where every item can take a very different amount of time: there,
+// every thread keeps grabbing the next item that nobody has taken yet until they're all gone.
+class ThreadPool {
+	public:
+		explicit ThreadPool(int numThreads) : numWorkers(numThreads < 1 ? 1 : numThreads) {
+			for (int w = 1; w < numWorkers; ++w) {
+				threads.emplace_back([this, w] { workerLoop(w); });
+			}
+		}
+
+		// Wake every worker up so they can see they need to stop, then wait for them.
+		~ThreadPool() {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+			}
+			wake.notify_all();
+			for (std::thread& t : threads) t.join();
+		}
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		// Number of threads work is split between (including the calling thread)
+		int size() const { return numWorkers; }
+
+		// Runs fn(begin, end, worker) over [0, count) and waits for every chunk to finish.
+		// Loops with no more than grain items aren't worth waking the workers for, so they run right here.
+		template <class Fn>
+		void parallelFor(int count, int grain, Fn& fn) {
+			if (numWorkers == 1 || count <= grain) {
+				if (count > 0) fn(0, count, 0);
+				return;
+			}
+
+			start(&invoke<Fn>, &fn, count, false);
+		}
+
+		// Runs fn(i, i + 1, worker) for every i in [0, count), handing the items out one at a time to
+		// whichever thread is free, and waits for all of them. Which thread gets which item isn't fixed,
+		// so fn should only depend on i (and use worker just to pick its scratch memory).
+		template <class Fn>
+		void parallelForEach(int count, Fn& fn) {
+			if (numWorkers == 1 || count <= 1) {
+				for (int i = 0; i < count; ++i) fn(i, i + 1, 0);
+				return;
+			}
+			start(&invoke<Fn>, &fn, count, true);
+		}
+
+	private:
+		int numWorkers;
+		std::vector<std::thread> threads;
+		std::mutex mutex;
+		std::condition_variable wake;     // signalled when there's a new job (or we're stopping)
+		std::condition_variable finished; // signalled when the last worker is done with a job
+		bool stopping = false;
+		long long jobId = 0;              // goes up by one for every job
+		int pending = 0;                  // workers still busy with the current job
+		void (*job)(void*, int, int, int) = nullptr;
+		void* jobContext = nullptr;
+		int jobCount = 0;
+		bool jobShared = false;           // true if the items are handed out one at a time (parallelForEach)
+		std::atomic<int> nextItem{0};     // next item nobody has taken yet, for shared jobs
+
+		// Hands a job to every worker, does the calling thread's part, then waits for the rest
+		void start(void (*fn)(void*, int, int, int), void* context, int count, bool shared) {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				job = fn;
+				jobContext = context;
+				jobCount = count;
+				jobShared = shared;
+				nextItem.store(0, std::memory_order_relaxed);
+				pending = numWorkers - 1;
+				jobId++;
+			}
+			wake.notify_all();
+
+			runChunk(0);
+
+			std::unique_lock<std::mutex> lock(mutex);
+			finished.wait(lock, [this] { return pending == 0; });
+		}
+
+		// Calls the actual loop body without needing a std::function (which could allocate)
+		template <class Fn>
+		static void invoke(void* context, int begin, int end, int worker) {
+			(*static_cast<Fn*>(context))(begin, end, worker);
+		}
+
+		// Works out which part of the loop belongs to this worker, and runs it
+		void runChunk(int worker) {
+			if (jobShared) {
+				for (int i = nextItem.fetch_add(1); i < jobCount; i = nextItem.fetch_add(1)) job(jobContext, i, i + 1, worker);
+				return;
+			}
+			int begin = (int)((long long)jobCount * worker / numWorkers);
+			int end = (int)((long long)jobCount * (worker + 1) / numWorkers);
+			if (begin < end) job(jobContext, begin, end, worker);
+		}
+
+		void workerLoop(int worker) {
+			long long seenJob = 0;
+			while (true) {
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					wake.wait(lock, [&] { return stopping || jobId != seenJob; });
+					if (stopping) return;
+					seenJob = jobId;
+				}
+				runChunk(worker);
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					if (--pending == 0) finished.notify_one();
+				}
+			}
+		}
+};
+
+// ==========================================
+//            MEMORY-MAPPED FILES
+// ==========================================
+// Maps a whole file into memory copy-on-write: every process that maps the same file shares the
+// same physical pages for as long as nobody writes to them, and a write only makes a private copy
+// of the page it touches (the file itself is never changed).
+class MappedFile {
+	public:
+		// Maps the file at path. Returns nullptr if it can't be opened or mapped.
+		static MappedFile* open(const std::string& path) {
+#ifdef _WIN32
+			HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (file == INVALID_HANDLE_VALUE) return nullptr;
+			LARGE_INTEGER fileSize;
+			HANDLE mapping = nullptr;
+			void* view = nullptr;
+			if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+				mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+				if (mapping) view = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+			}
+			if (mapping) CloseHandle(mapping); // the view keeps the mapping alive
+			CloseHandle(file);
+			if (!view) return nullptr;
+			return new MappedFile(view, (size_t)fileSize.QuadPart);
+#else
+			int fd = ::open(path.c_str(), O_RDONLY);
+			if (fd < 0) return nullptr;
+			struct stat info;
+			void* view = MAP_FAILED;
+			if (fstat(fd, &info) == 0 && info.st_size > 0) {
+				view = mmap(nullptr, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+			}
+			close(fd); // the mapping stays valid after the file is closed
+			if (view == MAP_FAILED) return nullptr;
+			return new MappedFile(view, (size_t)info.st_size);
+#endif
+		}
+
+		~MappedFile() {
+#ifdef _WIN32
+			UnmapViewOfFile(view);
+#else
+			munmap(view, length);
+#endif
+		}
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		unsigned char* data() const { return static_cast<unsigned char*>(view); }
+		size_t size() const { return length; }
+
+	private:
+		MappedFile(void* mappedView, size_t mappedLength) : view(mappedView), length(mappedLength) {}
+
+		void* view;
+		size_t length;
+};
+
+// ==========================================
+//              NEURAL NETWORK 
+// ==========================================
+class NeuralNetwork {
+	private:
+		// Activation function mapping inputs between values of 0-1 lives in kernels->sigmoid()
+		
+		// Backpropogation function used for readjusting the weights of the training data
+		static double sigmoidDerivative(double x) {
+			return x * (1.0 - x);
+		}
+
+		double learningRate = 0.5; // rate at which the AI learns
+
+		// Sets up the layers for this topology without any storage yet (used by the public constructor and load())
+		NeuralNetwork(const int* topology, int size, MappedFile* file) : num_layers(size - 1), storage(nullptr), storage_size(0), total_neurons(0), mapping(file) {
+			layers = new Layer[num_layers];
+			for (int l = 0; l < num_layers; ++l) {
+				Layer& layer = layers[l];
+				layer.num_neurons = topology[l + 1];
+				layer.num_inputs = topology[l];
+				layer.offset = total_neurons;
+				total_neurons += layer.num_neurons;
+				storage_size += layer.num_neurons * layer.num_inputs + layer.num_neurons; // weights + biases
+			}
+		}
+
+		// Hands out the slices of the storage to each layer
+		void assignStorage() {
+			double* next = storage;
+			for (int l = 0; l < num_layers; ++l) {
+				Layer& layer = layers[l];
+				layer.weights = next; next += layer.num_neurons * layer.num_inputs;
+				layer.biases = next;  next += layer.num_neurons;
+			}
+		}
+
+	public:
+		
+		// Represents each layer inside the neural network.
+		// A layer doesn't own any memory, it only points into the network's storage buffer.
+		struct Layer {
+			int num_neurons;  // neurons in this layer (rows of the weight matrix)
+			int num_inputs;   // inputs per neuron (columns of the weight matrix)
+			double* weights;  // num_neurons x num_inputs, row-major: row n holds neuron n's weights
+			double* biases;   // one bias per neuron
+			int offset;       // where this layer's outputs and deltas start inside a Workspace
+		};
+
+		// Scratch memory for predicting and training. Make one with makeWorkspace() and
+		// keep reusing it, then predict() and train() never allocate anything.
+		struct Workspace {
+			std::vector<double> outputs; // every layer's outputs back to back
+			std::vector<double> delta;   // every layer's deltas, laid out the same way as outputs
+		};
+
+		// Scratch memory for working on a whole batch of samples at once. Each layer gets a
+		// capacity x num_neurons matrix where row b belongs to sample b of the batch.
+		struct BatchWorkspace {
+			int capacity = 0;             // largest batch this workspace can hold
+			std::vector<double> outputs;  // every layer's output matrix back to back
+			std::vector<double> delta;    // every layer's delta matrix, laid out the same way as outputs
+		};
+
+		// Scratch memory for trainBatch(). A batch is cut into shards of SHARD_SIZE samples, every
+		// shard sums its adjustments into its own gradient buffer (on whichever thread picks it up),
+		// and the buffers are then added together pairwise like a tree. The shards and the order they
+		// are added in only depend on the batch, so the result is the same for any number of threads.
+		struct TrainingWorkspace {
+			static const int SHARD_SIZE = 32;    // samples per shard
+			int capacity = 0;                    // largest batch this workspace can hold
+			std::vector<BatchWorkspace> workers; // outputs and deltas for the shard each thread is working on
+			std::vector<double> shardGradients;  // one storage-sized gradient buffer per shard, back to back
+		};
+		
+		// Creation of variables for the layers of the neural network
+		Layer* layers;
+		int num_layers;
+		double* storage;   // every weight and bias of the network in one block
+		int storage_size;  // number of doubles inside storage
+		int total_neurons; // size of a Workspace
+		unsigned long long version = 0; // goes up every time the weights change, so cached predictions know when they're stale
+		MappedFile* mapping = nullptr;  // the model file the storage lives in, if the network was loaded from one
+
+		// Instantiate all the layers and the number of neurons inside each layer.
+		// The starting weights only depend on seed and the topology.
+		NeuralNetwork(int* topology, int size, unsigned long long seed = 0) : NeuralNetwork(topology, size, nullptr) {
+			storage = new double[storage_size]();
+			assignStorage();
+
+			// for now, randomly set the weights and biases of each neuron (every layer draws from its own stream).
+			for (int l = 0; l < num_layers; ++l) {
+				Layer& layer = layers[l];
+				CounterRng rng(seed, 0, CounterRng::STREAM_WEIGHTS, l);
+				for (int n = 0; n < layer.num_neurons; ++n) {
+					for (int i = 0; i < layer.num_inputs; ++i) {
+						layer.weights[n * layer.num_inputs + i] = rng.uniform() - 0.5;
+					}
+					layer.biases[n] = rng.uniform() - 0.5;
+				}
+			}
+		}
+
+		// The network owns raw memory, so don't allow copies of it.
+		NeuralNetwork(const NeuralNetwork&) = delete;
+		NeuralNetwork& operator=(const NeuralNetwork&) = delete;
+
+		// Free up the memory, all the layers live inside the one storage buffer
+		// (which is either ours, or part of a mapped model file).
+		~NeuralNetwork() {
+			delete[] layers;
+			if (mapping) delete mapping;
+			else delete[] storage;
+		}
+
+		// --- MODEL FILES ---
+		// A model file is a 128 byte header followed by the storage buffer exactly as it is in memory
+		// (each layer's weight matrix followed by its biases), so loading it is just mapping it.
+		// Numbers are stored in the machine's own byte order.
+		static const int MODEL_FORMAT_VERSION = 1;
+		static const int MODEL_MAX_LAYERS = 16;     // most topology entries the header has room for
+		static const int MODEL_HEADER_SIZE = 128;   // also where the weights start, keeping them 64 byte aligned
+
+		struct ModelHeader {
+			char magic[8];                           // "CAIMODEL"
+			uint32_t formatVersion;                  // MODEL_FORMAT_VERSION
+			uint32_t topologySize;                   // entries used in topology (layers + 1)
+			uint32_t topology[MODEL_MAX_LAYERS];     // neurons in each layer, inputs first
+			uint64_t storageSize;                    // doubles in the weight block
+			uint64_t dataOffset;                     // bytes from the start of the file to the weight block
+			uint64_t trainedVersion;                 // the network's version when it was saved
+			uint8_t padding[MODEL_HEADER_SIZE - 8 - 4 - 4 - 4 * MODEL_MAX_LAYERS - 3 * 8];
+		};
+		static_assert(sizeof(ModelHeader) == MODEL_HEADER_SIZE, "model header has to stay 128 bytes");
+
+		// Writes the network to a model file. Returns false if it couldn't be written.
+		// The file is written next to path first and then renamed over it, so saving over the model file the
+		// network was loaded from is safe (the mapping keeps the old file's pages until it's closed).
+		bool save(const std::string& path) const {
+			if (num_layers + 1 > MODEL_MAX_LAYERS) return false; // the header has no room for the topology
+			ModelHeader header;
+			memset(&header, 0, sizeof(header));
+			memcpy(header.magic, "CAIMODEL", 8);
+			header.formatVersion = MODEL_FORMAT_VERSION;
+			header.topologySize = num_layers + 1;
+			header.topology[0] = layers[0].num_inputs;
+			for (int l = 0; l < num_layers; ++l) header.topology[l + 1] = layers[l].num_neurons;
+			header.storageSize = storage_size;
+			header.dataOffset = MODEL_HEADER_SIZE;
+			header.trainedVersion = version;
+
+			std::string tempPath = path + ".tmp";
+			{
+				std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+				out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+				out.write(reinterpret_cast<const char*>(storage), (std::streamsize)storage_size * sizeof(double));
+				out.close();
+				if (!out) {
+					std::remove(tempPath.c_str());
+					return false;
+				}
+			}
+#ifdef _WIN32
+			bool replaced = MoveFileExA(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+			bool replaced = std::rename(tempPath.c_str(), path.c_str()) == 0;
+#endif
+			if (!replaced) std::remove(tempPath.c_str()); // (Windows won't replace a file that's still mapped)
+			return replaced;
+		}
+
+		// Loads a network straight out of a memory-mapped model file, without reading or copying the weights.
+		// The mapping is copy-on-write, so training afterwards only copies the pages it changes.
+		// Returns nullptr if the file is missing or isn't a valid model file.
+		static NeuralNetwork* load(const std::string& path) {
+			MappedFile* file = MappedFile::open(path);
+			if (!file) return nullptr;
+
+			// check the header before trusting anything in it
+			const ModelHeader* header = reinterpret_cast<const ModelHeader*>(file->data());
+			bool valid = file->size() >= sizeof(ModelHeader)
+				&& memcmp(header->magic, "CAIMODEL", 8) == 0
+				&& header->formatVersion == MODEL_FORMAT_VERSION
+				&& header->topologySize >= 2 && header->topologySize <= MODEL_MAX_LAYERS
+				&& header->dataOffset % 64 == 0 && header->dataOffset >= sizeof(ModelHeader);
+			int topology[MODEL_MAX_LAYERS];
+			uint64_t expectedSize = 0;
+			for (uint32_t i = 0; valid && i < header->topologySize; ++i) {
+				valid = header->topology[i] > 0 && header->topology[i] <= 1 << 16;
+				topology[i] = (int)header->topology[i];
+				if (valid && i > 0) expectedSize += (uint64_t)topology[i] * topology[i - 1] + topology[i];
+			}
+			// (compared without adding to dataOffset, so a huge offset can't wrap around and pass)
+			valid = valid && header->storageSize == expectedSize
+				&& header->dataOffset <= file->size()
+				&& expectedSize <= (file->size() - header->dataOffset) / sizeof(double);
+			if (!valid) {
+				delete file;
+				return nullptr;
+			}
+
+			NeuralNetwork* network = new NeuralNetwork(topology, (int)header->topologySize, file);
+			network->storage = reinterpret_cast<double*>(file->data() + header->dataOffset);
+			network->version = header->trainedVersion;
+			network->assignStorage();
+			return network;
+		}
+		
+		// Creates the scratch memory needed by predict() and train().
+		Workspace makeWorkspace() const {
+			Workspace ws;
+			ws.outputs.assign(total_neurons, 0.0);
+			ws.delta.assign(total_neurons, 0.0);
+			return ws;
+		}
+
+		// Creates the scratch memory needed by predictBatch() and trainBatch() for up to batchSize samples.
+		BatchWorkspace makeBatchWorkspace(int batchSize) const {
+			BatchWorkspace ws;
+			ws.capacity = batchSize;
+			ws.outputs.assign((size_t)batchSize * total_neurons, 0.0);
+			ws.delta.assign((size_t)batchSize * total_neurons, 0.0);
+			return ws;
+		}
+
+		// Creates the scratch memory needed by trainBatch() for batches of up to batchSize samples,
+		// trained by up to numThreads threads.
+		TrainingWorkspace makeTrainingWorkspace(int batchSize, int numThreads) const {
+			TrainingWorkspace ws;
+			ws.capacity = batchSize;
+			int shards = (batchSize + TrainingWorkspace::SHARD_SIZE - 1) / TrainingWorkspace::SHARD_SIZE;
+			int shardCapacity = (batchSize < TrainingWorkspace::SHARD_SIZE) ? batchSize : TrainingWorkspace::SHARD_SIZE;
+			for (int t = 0; t < numThreads; ++t) ws.workers.push_back(makeBatchWorkspace(shardCapacity));
+			ws.shardGradients.assign((size_t)shards * storage_size, 0.0);
+			return ws;
+		}
+
+		// Number of values written by predict()
+		int outputSize() const {
+			return layers[num_layers - 1].num_neurons;
+		}
+		
+		// Based on the neural network, predict and evaluate the right output value based on the input.
+		// Every layer's result is written into the workspace, and the returned pointer points at the
+		// last layer inside it (so it's only valid until the workspace is used again, don't delete this!)
+		const double* predict(const double* inputs, Workspace& ws) const {
+			const double* current_inputs = inputs;
+			for (int l = 0; l < num_layers; ++l) {
+				const Layer& layer = layers[l];
+				double* outputs = ws.outputs.data() + layer.offset;
+				const double* w = layer.weights;
+				for (int n = 0; n < layer.num_neurons; ++n, w += layer.num_inputs) {
+					// w points at row n of the weight matrix, so this is a straight walk through memory
+					outputs[n] = layer.biases[n] + kernels->dot(current_inputs, w, layer.num_inputs);
+				}
+				kernels->sigmoid(outputs, layer.num_neurons); // evaluate the output between the inputs based on the weights and bias
+				current_inputs = outputs; // the output of this layer is the input of the next one
+			}
+			return current_inputs;
+		}
+		
+		// Adjust for the neural network's ACTUAL weights and biases based on the expected value and trained data.
+		void train(const double* inputs, const double* expected, Workspace& ws) {
+			version++;
+			predict(inputs, ws); // to get the initial evaluation of the inputs
+			double* outputs = ws.outputs.data();
+			double* delta = ws.delta.data();
+
+			// Compute delta/error for each neuron in the output layer
+			Layer& outputLayer = layers[num_layers - 1];
+			for (int i = 0; i < outputLayer.num_neurons; ++i) {
+				// compute the necessary adjustments based on the output, expected and the sigmoid
+				double out = outputs[outputLayer.offset + i];
+				delta[outputLayer.offset + i] = (expected[i] - out) * sigmoidDerivative(out);
+			}
+
+			// Compute delta/error for each neuron in the hidden layers
+			for (int l = num_layers - 2; l >= 0; --l) {
+				Layer& current = layers[l];
+				Layer& next = layers[l + 1];
+				double* currentDelta = delta + current.offset;
+				for (int i = 0; i < current.num_neurons; ++i) {
+					currentDelta[i] = 0.0;
+				}
+				for (int j = 0; j < next.num_neurons; ++j) {
+					// walk the next layer's weight matrix row by row, spreading its error back to this layer
+					const double* w = next.weights + j * next.num_inputs;
+					kernels->axpy(currentDelta, w, delta[next.offset + j], current.num_neurons);
+				}
+				for (int i = 0; i < current.num_neurons; ++i) {
+					currentDelta[i] *= sigmoidDerivative(outputs[current.offset + i]);
+				}
+			}
+
+			// Update the weights and biases in each layer
+			for (int l = 0; l < num_layers; ++l) {
+				Layer& layer = layers[l];
+				// the input layer reads the training inputs, the rest read the outputs of the previous layer
+				const double* layerInputs = (l == 0) ? inputs : outputs + layers[l - 1].offset;
+				
+				double* w = layer.weights;
+				for (int n = 0; n < layer.num_neurons; ++n, w += layer.num_inputs) {
+					// compute the weights based on learning rate, delta, and the layers output
+					double step = learningRate * delta[layer.offset + n];
+					kernels->axpy(w, layerInputs, step, layer.num_inputs);
+					layer.biases[n] += step;
+				}
+			}
+		}
+
+		// Predicts a whole batch at once. inputs holds count rows (count <= ws.capacity), one sample per row.
+		// Returns the output matrix of the last layer, where row b is the prediction for sample b
+		// (only valid until the workspace is used again)
+		const double* predictBatch(const double* inputs, int count, BatchWorkspace& ws) const {
+			const double* current_inputs = inputs;
+			for (int l = 0; l < num_layers; ++l) {
+				const Layer& layer = layers[l];
+				double* outputs = ws.outputs.data() + (size_t)ws.capacity * layer.offset;
+				for (int b = 0; b < count; b += KERNEL_BLOCK_ROWS) {
+					// multiply a block of samples' rows with every row of the weight matrix, so every
+					// weight that's loaded is used for the whole block (dotRows adds up each row exactly
+					// like dot, so this still matches predict() bit for bit)
+					int rows = (count - b < KERNEL_BLOCK_ROWS) ? count - b : KERNEL_BLOCK_ROWS;
+					const double* in[KERNEL_BLOCK_ROWS];
+					for (int r = 0; r < rows; ++r) in[r] = current_inputs + (size_t)(b + r) * layer.num_inputs;
+					double* out = outputs + (size_t)b * layer.num_neurons;
+					const double* w = layer.weights;
+					for (int n = 0; n < layer.num_neurons; ++n, w += layer.num_inputs) {
+						double dots[KERNEL_BLOCK_ROWS];
+						kernels->dotRows(in, rows, w, layer.num_inputs, dots);
+						for (int r = 0; r < rows; ++r) out[(size_t)r * layer.num_neurons + n] = layer.biases[n] + dots[r];
+					}
+				}
+				kernels->sigmoid(outputs, count * layer.num_neurons); // the whole matrix in one go
+				current_inputs = outputs; // this layer's output matrix is the next layer's input matrix
+			}
+			return current_inputs;
+		}
+
+		// Trains on count samples with mini-batches: every batchSize samples the gradients are summed up
+		// and applied once (averaged over the batch), and the whole set is gone through epochs times.
+		// The shards of each batch are spread over the pool's threads (see TrainingWorkspace).
+		// inputs and expected hold one sample per row. batchSize must not be bigger than ws.capacity,
+		// and the pool must not have more threads than the workspace was made for.
+		void trainBatch(const double* inputs, const double* expected, int count, int batchSize, int epochs, TrainingWorkspace& ws, ThreadPool& pool) {
+			int num_inputs = layers[0].num_inputs;
+			int num_outputs = outputSize();
+			if (batchSize > ws.capacity) batchSize = ws.capacity;
+			if (count > 0) version++;
+
+			for (int epoch = 0; epoch < epochs; ++epoch) {
+				for (int start = 0; start < count; start += batchSize) {
+					int size = (count - start < batchSize) ? count - start : batchSize;
+					const double* batchInputs = inputs + (size_t)start * num_inputs;
+					const double* batchExpected = expected + (size_t)start * num_outputs;
+					int shards = (size + TrainingWorkspace::SHARD_SIZE - 1) / TrainingWorkspace::SHARD_SIZE;
+
+					// every shard works out its own gradients
+					auto shardPass = [&](int begin, int end, int worker) {
+						for (int s = begin; s < end; ++s) {
+							int first = s * TrainingWorkspace::SHARD_SIZE;
+							int shardSize = (size - first < TrainingWorkspace::SHARD_SIZE) ? size - first : TrainingWorkspace::SHARD_SIZE;
+							accumulateGradients(batchInputs + (size_t)first * num_inputs, batchExpected + (size_t)first * num_outputs,
+							                    shardSize, ws.workers[worker], ws.shardGradients.data() + (size_t)s * storage_size);
+						}
+					};
+					pool.parallelFor(shards, 1, shardPass);
+
+					// add them up as a tree: shard s takes in shard s + stride, with stride doubling every level.
+					// Each level splits the weights between the threads, so even the last add is shared.
+					for (int stride = 1; stride < shards; stride *= 2) {
+						auto reduce = [&](int begin, int end, int) {
+							for (int s = 0; s + stride < shards; s += 2 * stride) {
+								double* into = ws.shardGradients.data() + (size_t)s * storage_size;
+								const double* from = into + (size_t)stride * storage_size;
+								for (int i = begin; i < end; ++i) into[i] += from[i];
+							}
+						};
+						pool.parallelFor(storage_size, 4096, reduce);
+					}
+					
+					// apply the summed gradients once for the whole batch
+					kernels->axpy(storage, ws.shardGradients.data(), learningRate / size, storage_size);
+				}
+			}
+		}
+
+	private:
+		// Runs a forward and backward pass over one batch and sums every sample's adjustments into grad
+		// (storage_size values, laid out like storage).
+		void accumulateGradients(const double* inputs, const double* expected, int count, BatchWorkspace& ws, double* grad) const {
+			predictBatch(inputs, count, ws); // to get the initial evaluation of the whole batch
+			for (int i = 0; i < storage_size; ++i) {
+				grad[i] = 0.0;
+			}
+
+			// Compute the delta matrix of the output layer
+			const Layer& outputLayer = layers[num_layers - 1];
+			const double* outOutputs = ws.outputs.data() + (size_t)ws.capacity * outputLayer.offset;
+			double* outDelta = ws.delta.data() + (size_t)ws.capacity * outputLayer.offset;
+			for (int i = 0; i < count * outputLayer.num_neurons; ++i) {
+				outDelta[i] = (expected[i] - outOutputs[i]) * sigmoidDerivative(outOutputs[i]);
+			}
+
+			// Compute the delta matrices of the hidden layers (delta of the next layer times its weight matrix)
+			for (int l = num_layers - 2; l >= 0; --l) {
+				const Layer& current = layers[l];
+				const Layer& next = layers[l + 1];
+				const double* currentOutputs = ws.outputs.data() + (size_t)ws.capacity * current.offset;
+				double* currentDelta = ws.delta.data() + (size_t)ws.capacity * current.offset;
+				const double* nextDelta = ws.delta.data() + (size_t)ws.capacity * next.offset;
+				for (int b = 0; b < count; ++b) {
+					double* d = currentDelta + (size_t)b * current.num_neurons;
+					const double* nd = nextDelta + (size_t)b * next.num_neurons;
+					for (int i = 0; i < current.num_neurons; ++i) {
+						d[i] = 0.0;
+					}
+					// a block of the next layer's weight rows at a time, so d is only loaded and stored once per block
+					for (int j = 0; j < next.num_neurons; j += KERNEL_BLOCK_ROWS) {
+						int rows = (next.num_neurons - j < KERNEL_BLOCK_ROWS) ? next.num_neurons - j : KERNEL_BLOCK_ROWS;
+						const double* w[KERNEL_BLOCK_ROWS];
+						for (int r = 0; r < rows; ++r) w[r] = next.weights + (size_t)(j + r) * next.num_inputs;
+						kernels->axpyRows(d, w, nd + j, rows, current.num_neurons);
+					}
+					const double* out = currentOutputs + (size_t)b * current.num_neurons;
+					for (int i = 0; i < current.num_neurons; ++i) {
+						d[i] *= sigmoidDerivative(out[i]);
+					}
+				}
+			}
+
+			// Sum up the gradients: delta matrix (transposed) times the layer's input matrix
+			for (int l = 0; l < num_layers; ++l) {
+				const Layer& layer = layers[l];
+				const double* layerInputs = (l == 0) ? inputs : ws.outputs.data() + (size_t)ws.capacity * layers[l - 1].offset;
+				const double* layerDelta = ws.delta.data() + (size_t)ws.capacity * layer.offset;
+				double* gradWeights = grad + (layer.weights - storage);
+				double* gradBiases = grad + (layer.biases - storage);
+				for (int b = 0; b < count; b += KERNEL_BLOCK_ROWS) {
+					// a block of samples at a time: every gradient row takes in all of the block's inputs while
+					// it's in registers (the samples still get added in order, so this sums up exactly like
+					// one axpy per sample did)
+					int rows = (count - b < KERNEL_BLOCK_ROWS) ? count - b : KERNEL_BLOCK_ROWS;
+					const double* in[KERNEL_BLOCK_ROWS];
+					for (int r = 0; r < rows; ++r) in[r] = layerInputs + (size_t)(b + r) * layer.num_inputs;
+					const double* d = layerDelta + (size_t)b * layer.num_neurons;
+					double* g = gradWeights;
+					for (int n = 0; n < layer.num_neurons; ++n, g += layer.num_inputs) {
+						double steps[KERNEL_BLOCK_ROWS];
+						for (int r = 0; r < rows; ++r) {
+							steps[r] = d[(size_t)r * layer.num_neurons + n];
+							gradBiases[n] += steps[r];
+						}
+						kernels->axpyRows(g, in, steps, rows, layer.num_inputs);
+					}
+				}
+			}
+		}
+};
+
+NeuralNetwork* sharedBrain = nullptr; // brain to be used by all the students
+
+// ==========================================
+//          STATIC NEURAL NETWORK
+// ==========================================
+// The same network as NeuralNetwork, but with the layer sizes fixed at compile time, e.g.
+// StaticNetwork<4, 8, 4>. The weights live in one std::array (laid out exactly like
+// NeuralNetwork's storage, so they can be copied back and forth) and every loop bound is a
+// constant, so the compiler can unroll and vectorize the small matrix-vector products completely
+// (wide layers still use the SIMD kernels, see WIDE).
+// It has the same predict() / train() / makeWorkspace() / outputSize() / version members as
+// NeuralNetwork and gives the same results, so code written against those works with either one.
+template <int... Sizes>
+class StaticNetwork {
+	static_assert(sizeof...(Sizes) >= 2, "a network needs at least an input and an output layer");
+
+	public:
+		static constexpr int NUM_LAYERS = sizeof...(Sizes) - 1;
+		static constexpr int SIZES[sizeof...(Sizes)] = {Sizes...};
+		static constexpr int INPUTS = SIZES[0];
+		static constexpr int OUTPUTS = SIZES[NUM_LAYERS];
+
+		// Where layer l's weights start in the storage (its biases come right after them)
+		static constexpr int weightOffset(int l) {
+			int offset = 0;
+			for (int i = 0; i < l; ++i) offset += SIZES[i + 1] * SIZES[i] + SIZES[i + 1];
+			return offset;
+		}
+		static constexpr int biasOffset(int l) { return weightOffset(l) + SIZES[l + 1] * SIZES[l]; }
+
+		// Where layer l's outputs and deltas start inside a Workspace
+		static constexpr int neuronOffset(int l) {
+			int offset = 0;
+			for (int i = 0; i < l; ++i) offset += SIZES[i + 1];
+			return offset;
+		}
+
+		static constexpr int STORAGE_SIZE = weightOffset(NUM_LAYERS);
+		static constexpr int TOTAL_NEURONS = neuronOffset(NUM_LAYERS);
+
+		// Scratch memory for predict() and train(), the same idea as NeuralNetwork::Workspace but fixed size
+		struct Workspace {
+			std::array<double, TOTAL_NEURONS> outputs; // every layer's outputs back to back
+			std::array<double, TOTAL_NEURONS> delta;   // every layer's deltas, laid out the same way
+		};
+
+		std::array<double, STORAGE_SIZE> storage{}; // every weight and bias, in NeuralNetwork's layout
+		unsigned long long version = 0;             // goes up every time the weights change
+
+		Workspace makeWorkspace() const { return Workspace(); }
+		int outputSize() const { return OUTPUTS; }
+
+		// Takes the weights (and version) of a dynamic network. Returns false if its topology is different.
+		bool copyFrom(const NeuralNetwork &network) {
+			if (!sameTopology(network)) return false;
+			std::copy(network.storage, network.storage + STORAGE_SIZE, storage.begin());
+			version = network.version;
+			return true;
+		}
+
+		// Gives the weights to a dynamic network. Returns false if its topology is different.
+		bool copyTo(NeuralNetwork &network) const {
+			if (!sameTopology(network)) return false;
+			std::copy(storage.begin(), storage.end(), network.storage);
+			network.version++;
+			return true;
+		}
+
+		// Same as NeuralNetwork::predict()
+		const double* predict(const double* inputs, Workspace &ws) const {
+			forward<0>(inputs, ws);
+			return ws.outputs.data() + neuronOffset(NUM_LAYERS - 1);
+		}
+
+		// Same as NeuralNetwork::train()
+		void train(const double* inputs, const double* expected, Workspace &ws) {
+			version++;
+			predict(inputs, ws); // to get the initial evaluation of the inputs
+
+			// delta/error for each neuron in the output layer
+			const double* out = ws.outputs.data() + neuronOffset(NUM_LAYERS - 1);
+			double* outDelta = ws.delta.data() + neuronOffset(NUM_LAYERS - 1);
+			for (int i = 0; i < OUTPUTS; ++i) {
+				outDelta[i] = (expected[i] - out[i]) * (out[i] * (1.0 - out[i]));
+			}
+
+			backward<NUM_LAYERS - 2>(ws);
+			update<0>(inputs, ws);
+		}
+
+	private:
+		static constexpr double LEARNING_RATE = 0.5; // same as NeuralNetwork's
+
+		// Rows at least this long go through the SIMD kernels instead (this file is built for plain x86-64,
+		// so the unrolled loops only get SSE2, while the kernels can use AVX2 / AVX-512 when the CPU has them)
+		static constexpr int WIDE = 16;
+
+		bool sameTopology(const NeuralNetwork &network) const {
+			if (network.num_layers != NUM_LAYERS) return false;
+			for (int l = 0; l < NUM_LAYERS; ++l) {
+				if (network.layers[l].num_inputs != SIZES[l] || network.layers[l].num_neurons != SIZES[l + 1]) return false;
+			}
+			return true;
+		}
+
+		// Layer L and everything after it
+		template <int L>
+		void forward(const double* in, Workspace &ws) const {
+			if constexpr (L < NUM_LAYERS) {
+				constexpr int IN = SIZES[L], OUT = SIZES[L + 1];
+				const double* w = storage.data() + weightOffset(L);
+				const double* b = storage.data() + biasOffset(L);
+				double* out = ws.outputs.data() + neuronOffset(L);
+				for (int n = 0; n < OUT; ++n) {
+					const double* row = w + n * IN;
+					if constexpr (IN >= WIDE) {
+						out[n] = b[n] + kernels->dot(in, row, IN);
+					} else {
+						double sum = 0.0;
+						for (int k = 0; k < IN; ++k) sum += row[k] * in[k];
+						out[n] = b[n] + sum;
+					}
+				}
+				kernels->sigmoid(out, OUT);
+				forward<L + 1>(out, ws);
+			}
+		}
+
+		// Spreads the error of layer L + 1 back to layer L, then carries on towards the input
+		template <int L>
+		void backward(Workspace &ws) const {
+			if constexpr (L >= 0) {
+				constexpr int N = SIZES[L + 1], NEXT = SIZES[L + 2];
+				const double* nextW = storage.data() + weightOffset(L + 1);
+				const double* nextDelta = ws.delta.data() + neuronOffset(L + 1);
+				const double* out = ws.outputs.data() + neuronOffset(L);
+				double* d = ws.delta.data() + neuronOffset(L);
+				for (int i = 0; i < N; ++i) d[i] = 0.0;
+				for (int j = 0; j < NEXT; ++j) {
+					if constexpr (N >= WIDE) kernels->axpy(d, nextW + j * N, nextDelta[j], N);
+					else for (int i = 0; i < N; ++i) d[i] += nextDelta[j] * nextW[j * N + i];
+				}
+				for (int i = 0; i < N; ++i) d[i] *= out[i] * (1.0 - out[i]);
+				backward<L - 1>(ws);
+			}
+		}
+
+		// Adjusts the weights and biases of layer L and everything after it
+		template <int L>
+		void update(const double* inputs, const Workspace &ws) {
+			if constexpr (L < NUM_LAYERS) {
+				constexpr int IN = SIZES[L], OUT = SIZES[L + 1];
+				const double* in = (L == 0) ? inputs : ws.outputs.data() + neuronOffset(L - 1);
+				const double* d = ws.delta.data() + neuronOffset(L);
+				double* w = storage.data() + weightOffset(L);
+				double* b = storage.data() + biasOffset(L);
+				for (int n = 0; n < OUT; ++n) {
+					double step = LEARNING_RATE * d[n];
+					if constexpr (IN >= WIDE) kernels->axpy(w + n * IN, in, step, IN);
+					else for (int k = 0; k < IN; ++k) w[n * IN + k] += step * in[k];
+					b[n] += step;
+				}
+				update<L + 1>(inputs, ws);
+			}
+		}
+};
+
+using FastBrain = StaticNetwork<4, 8, 4>; // the topology main() builds, for --static-network
+
+// Checks a StaticNetwork against a NeuralNetwork with the same weights: predicts and trains both on the
+// same made up samples, then hands the static weights to a fresh dynamic network and predicts with that
+// too. Returns the biggest difference seen in the outputs or the weights.
+template <int... Sizes>
+double verifyStaticNetwork() {
+	int topology[] = {Sizes...};
+	NeuralNetwork dynamic(topology, (int)sizeof...(Sizes));
+	StaticNetwork<Sizes...>* fixed = new StaticNetwork<Sizes...>(); // can be big, keep it off the stack
+	fixed->copyFrom(dynamic);
+	NeuralNetwork::Workspace dynamicWs = dynamic.makeWorkspace();
+	typename StaticNetwork<Sizes...>::Workspace fixedWs = fixed->makeWorkspace();
+
+	const int INPUTS = topology[0];
+	const int OUTPUTS = dynamic.outputSize();
+	std::vector<double> inputs(INPUTS), expected(OUTPUTS);
+	double worst = 0.0;
+	for (int sample = 0; sample < 200; ++sample) {
+		for (int k = 0; k < INPUTS; ++k) inputs[k] = ((sample * 7 + k * 13) % 101) / 100.0;
+		for (int o = 0; o < OUTPUTS; ++o) expected[o] = (o == sample % OUTPUTS) ? 1.0 : 0.0;
+
+		const double* a = dynamic.predict(inputs.data(), dynamicWs);
+		const double* b = fixed->predict(inputs.data(), fixedWs);
+		for (int o = 0; o < OUTPUTS; ++o) worst = std::max(worst, std::fabs(a[o] - b[o]));
+
+		dynamic.train(inputs.data(), expected.data(), dynamicWs);
+		fixed->train(inputs.data(), expected.data(), fixedWs);
+	}
+	for (int i = 0; i < dynamic.storage_size; ++i) worst = std::max(worst, std::fabs(dynamic.storage[i] - fixed->storage[i]));
+
+	// the way back: a differently seeded network given the trained static weights should predict the same
+	NeuralNetwork copied(topology, (int)sizeof...(Sizes), 12345);
+	if (!fixed->copyTo(copied)) worst = INFINITY;
+	NeuralNetwork::Workspace copiedWs = copied.makeWorkspace();
+	for (int sample = 0; sample < 20; ++sample) {
+		for (int k = 0; k < INPUTS; ++k) inputs[k] = ((sample * 11 + k * 5) % 97) / 96.0;
+		const double* a = copied.predict(inputs.data(), copiedWs);
+		const double* b = fixed->predict(inputs.data(), fixedWs);
+		for (int o = 0; o < OUTPUTS; ++o) worst = std::max(worst, std::fabs(a[o] - b[o]));
+	}
+	delete fixed;
+	return worst;
+}
+
+// ==========================================
+//         REDUCED-PRECISION NETWORK
+// ==========================================
+// A predict-only copy of a NeuralNetwork in smaller numbers, rebuilt from the double network every
+// time it learns something. The policy only uses the outputs to break ties between greedy moves,
+// so it doesn't need 16 digits:
+//  - PRECISION_FLOAT keeps every weight as a float: half the memory, and twice as many per SIMD register.
+//    Its sigmoid reads between the entries of the lookup table.
+//  - PRECISION_INT8 keeps every weight as a signed byte plus one scale per neuron: a quarter of the
+//    memory. The activations between layers are bytes too (0..127 stands for 0..1), so the dot
+//    products are done in whole numbers, and the sigmoid is a table lookup.
+// The weights are stored input by input (all of input 0's weights, then input 1's...), so a batch goes
+// through the block kernels KERNEL_BLOCK_ROWS rows at a time: every weight that's loaded goes into all
+// of the block's rows, and the sums for a row of neurons sit side by side in SIMD registers.
+// precisionMismatchRate() measures how often this changes the direction the network likes best.
+enum Precision { PRECISION_DOUBLE, PRECISION_FLOAT, PRECISION_INT8 };
+
+const char* const PRECISION_NAMES[] = {"double", "float", "int8"};
+
+class ReducedNetwork {
+	public:
+		static const int ACTIVATION_ONE = 127;        // the byte that stands for an activation of 1.0
+		static const int SIGMOID_TABLE_SIZE = 1024;   // entries in the sigmoid lookup table
+		static constexpr float SIGMOID_RANGE = 8.0f;  // the table covers [-8, 8], the sigmoid is flat past that
+
+		Precision precision = PRECISION_FLOAT;
+		unsigned long long version = ~0ULL; // the network version the weights were copied from
+
+		// Scratch memory for predict() and predictBatch(). Make one with makeWorkspace() and keep reusing it.
+		struct Workspace {
+			int capacity = 0;            // most rows predictBatch() can take at once
+			std::vector<float> values;   // float mode: every row's inputs, then every layer's outputs back to back
+			std::vector<uint8_t> codes;  // int8 mode: the same, as bytes
+			std::vector<float> sums;     // float mode: one block's dot products (KERNEL_BLOCK_ROWS x widest layer)
+			std::vector<int32_t> accs;   // int8 mode: the same, in whole numbers
+			std::vector<double> outputs; // the last layer's outputs as doubles, like NeuralNetwork gives them
+		};
+
+		// Builds the weights from network in the given precision (PRECISION_FLOAT or PRECISION_INT8).
+		// Only allocates the first time, or if the topology changes.
+		void copyFrom(const NeuralNetwork &network, Precision p) {
+			precision = p;
+			version = network.version;
+			layers.resize(network.num_layers);
+			size_t weightCount = 0;
+			int slot = network.layers[0].num_inputs; // the inputs take the first slots of a workspace
+			int inputSlot = 0;
+			widest = 0;
+			for (int l = 0; l < network.num_layers; ++l) {
+				const NeuralNetwork::Layer &source = network.layers[l];
+				Layer &layer = layers[l];
+				layer.num_neurons = source.num_neurons;
+				layer.num_inputs = source.num_inputs;
+				layer.weightOffset = weightCount;
+				layer.neuronOffset = slot - network.layers[0].num_inputs;
+				layer.inputSlot = inputSlot;
+				layer.outputSlot = slot;
+				weightCount += (size_t)source.num_neurons * source.num_inputs;
+				inputSlot = slot;
+				slot += source.num_neurons;
+				widest = std::max(widest, source.num_neurons);
+			}
+			numSlots = slot;
+			int numNeurons = slot - network.layers[0].num_inputs;
+			biases.resize(numNeurons);
+			scales.resize(numNeurons);
+			if (precision == PRECISION_FLOAT) floatWeights.resize(weightCount);
+			else int8Weights.resize(weightCount);
+
+			for (int l = 0; l < network.num_layers; ++l) {
+				const NeuralNetwork::Layer &source = network.layers[l];
+				const Layer &layer = layers[l];
+				for (int n = 0; n < layer.num_neurons; ++n) {
+					const double* row = source.weights + (size_t)n * layer.num_inputs;
+					// input i's weight into neuron n goes to [i][n] (see the top of this section)
+					size_t out = layer.weightOffset + n;
+					biases[layer.neuronOffset + n] = (float)source.biases[n];
+					if (precision == PRECISION_FLOAT) {
+						for (int i = 0; i < layer.num_inputs; ++i) floatWeights[out + (size_t)i * layer.num_neurons] = (float)row[i];
+						continue;
+					}
+					// the biggest weight in the row becomes +-127, the rest are rounded to the same step
+					double largest = 0.0;
+					for (int i = 0; i < layer.num_inputs; ++i) largest = std::max(largest, std::fabs(row[i]));
+					double step = (largest > 0.0) ? largest / 127.0 : 1.0;
+					for (int i = 0; i < layer.num_inputs; ++i) {
+						long q = std::lround(row[i] / step);
+						int8Weights[out + (size_t)i * layer.num_neurons] = (int8_t)std::max(-127L, std::min(127L, q));
+					}
+					scales[layer.neuronOffset + n] = (float)(step / ACTIVATION_ONE); // one step of weight times one step of activation
+				}
+			}
+
+			if (sigmoidValues.empty()) {
+				sigmoidValues.resize(SIGMOID_TABLE_SIZE + 1);
+				sigmoidCodes.resize(SIGMOID_TABLE_SIZE);
+				for (int t = 0; t < SIGMOID_TABLE_SIZE; ++t) {
+					double x = -SIGMOID_RANGE + 2.0 * SIGMOID_RANGE * t / (SIGMOID_TABLE_SIZE - 1);
+					double y = 1 / (1 + exp(-x));
+					sigmoidValues[t] = (float)y;
+					sigmoidCodes[t] = (uint8_t)std::lround(y * ACTIVATION_ONE);
+				}
+				sigmoidValues[SIGMOID_TABLE_SIZE] = sigmoidValues[SIGMOID_TABLE_SIZE - 1]; // (see sigmoidSmooth())
+			}
+		}
+
+		// Creates the scratch memory needed by predict(), and by predictBatch() for up to capacity rows
+		Workspace makeWorkspace(int capacity = 1) const {
+			Workspace ws;
+			ws.capacity = capacity;
+			ws.values.assign((size_t)capacity * numSlots, 0.0f);
+			ws.codes.assign((size_t)capacity * numSlots, 0);
+			ws.sums.assign((size_t)KERNEL_BLOCK_ROWS * widest, 0.0f);
+			ws.accs.assign((size_t)KERNEL_BLOCK_ROWS * widest, 0);
+			ws.outputs.assign((size_t)capacity * outputSize(), 0.0);
+			return ws;
+		}
+
+		int outputSize() const { return layers.back().num_neurons; }
+
+		// Bytes taken up by the weights
+		size_t weightBytes() const {
+			return (precision == PRECISION_FLOAT) ? floatWeights.size() * sizeof(float) : int8Weights.size();
+		}
+
+		// Same as NeuralNetwork::predict(), for one row of inputs
+		const double* predict(const double* inputs, Workspace &ws) const {
+			return predictBatch(inputs, 1, ws);
+		}
+
+		// Same as NeuralNetwork::predictBatch(): count rows of inputs (count <= ws.capacity) go in, and
+		// the returned matrix has row b's outputs at b * outputSize() (only valid until ws is used again)
+		const double* predictBatch(const double* inputs, int count, Workspace &ws) const {
+			int numInputs = layers[0].num_inputs;
+			int numOutputs = outputSize();
+			int last = (int)layers.size() - 1;
+			if (precision == PRECISION_FLOAT) {
+				for (int b = 0; b < count; ++b) {
+					for (int i = 0; i < numInputs; ++i) ws.values[(size_t)b * numSlots + i] = (float)inputs[(size_t)b * numInputs + i];
+				}
+			}
+			else {
+				for (int b = 0; b < count; ++b) {
+					for (int i = 0; i < numInputs; ++i) {
+						double x = std::max(0.0, std::min(1.0, inputs[(size_t)b * numInputs + i]));
+						ws.codes[(size_t)b * numSlots + i] = (uint8_t)std::lround(x * ACTIVATION_ONE);
+					}
+				}
+			}
+
+			for (int l = 0; l <= last; ++l) {
+				const Layer &layer = layers[l];
+				int width = layer.num_neurons;
+				for (int first = 0; first < count; first += KERNEL_BLOCK_ROWS) {
+					int rows = std::min(KERNEL_BLOCK_ROWS, count - first);
+					if (precision == PRECISION_FLOAT) {
+						const float* in[KERNEL_BLOCK_ROWS];
+						float* sums[KERNEL_BLOCK_ROWS];
+						for (int r = 0; r < rows; ++r) {
+							in[r] = ws.values.data() + (size_t)(first + r) * numSlots + layer.inputSlot;
+							sums[r] = ws.sums.data() + (size_t)r * width;
+							std::copy(biases.begin() + layer.neuronOffset, biases.begin() + layer.neuronOffset + width, sums[r]);
+						}
+						kernels->blockFloat(in, rows, floatWeights.data() + layer.weightOffset, layer.num_inputs, width, sums);
+						for (int r = 0; r < rows; ++r) {
+							float* out = ws.values.data() + (size_t)(first + r) * numSlots + layer.outputSlot;
+							for (int n = 0; n < width; ++n) {
+								float y = sigmoidSmooth(sums[r][n]);
+								out[n] = y;
+								if (l == last) ws.outputs[(size_t)(first + r) * numOutputs + n] = y;
+							}
+						}
+						continue;
+					}
+					const uint8_t* in[KERNEL_BLOCK_ROWS];
+					int32_t* accs[KERNEL_BLOCK_ROWS];
+					for (int r = 0; r < rows; ++r) {
+						in[r] = ws.codes.data() + (size_t)(first + r) * numSlots + layer.inputSlot;
+						accs[r] = ws.accs.data() + (size_t)r * width;
+						std::fill(accs[r], accs[r] + width, 0);
+					}
+					kernels->blockInt8(in, rows, int8Weights.data() + layer.weightOffset, layer.num_inputs, width, accs);
+					for (int r = 0; r < rows; ++r) {
+						uint8_t* out = ws.codes.data() + (size_t)(first + r) * numSlots + layer.outputSlot;
+						for (int n = 0; n < width; ++n) {
+							int t = sigmoidIndex(biases[layer.neuronOffset + n] + scales[layer.neuronOffset + n] * accs[r][n]);
+							if (l == last) ws.outputs[(size_t)(first + r) * numOutputs + n] = sigmoidValues[t];
+							else out[n] = sigmoidCodes[t];
+						}
+					}
+				}
+			}
+			return ws.outputs.data();
+		}
+
+	private:
+		struct Layer {
+			int num_neurons;
+			int num_inputs;
+			size_t weightOffset; // where this layer's weight matrix starts (input by input, see above)
+			int neuronOffset;    // where this layer's biases and scales start
+			int inputSlot;       // where this layer's inputs start inside a workspace row
+			int outputSlot;      // where this layer's outputs start inside a workspace row
+		};
+		std::vector<Layer> layers;
+		int numSlots = 0;  // values per row of a workspace
+		int widest = 0;    // most neurons in any layer
+		std::vector<float> floatWeights;
+		std::vector<int8_t> int8Weights;
+		std::vector<float> biases;
+		std::vector<float> scales;          // int8 mode: what one unit of a neuron's whole-number dot product is worth
+		std::vector<float> sigmoidValues;   // the sigmoid at evenly spaced points over [-SIGMOID_RANGE, SIGMOID_RANGE] (+ 1 spare)
+		std::vector<uint8_t> sigmoidCodes;  // the same values as activation bytes
+
+		// The table entry nearest to x
+		static int sigmoidIndex(float x) {
+			float t = (x + SIGMOID_RANGE) * ((SIGMOID_TABLE_SIZE - 1) / (2.0f * SIGMOID_RANGE)) + 0.5f;
+			if (!(t > 0.0f)) return 0; // also catches NaN
+			return (t >= SIGMOID_TABLE_SIZE - 1) ? SIGMOID_TABLE_SIZE - 1 : (int)t;
+		}
+
+		// The sigmoid of x, drawn as a straight line between the two nearest table entries
+		// (within a few millionths, which is all a float has room for anyway, and far cheaper than exp)
+		// (clamped without branches, NaN included: the table has a copy of its last entry on the end,
+		// so past either end this lands right on the first or last entry)
+		float sigmoidSmooth(float x) const {
+			float t = (x + SIGMOID_RANGE) * ((SIGMOID_TABLE_SIZE - 1) / (2.0f * SIGMOID_RANGE));
+			t = std::min(std::max(0.0f, t), (float)(SIGMOID_TABLE_SIZE - 1));
+			int i = (int)t;
+			const float* table = sigmoidValues.data();
+			return table[i] + (t - i) * (table[i + 1] - table[i]);
+		}
+};
+
+constexpr float ReducedNetwork::SIGMOID_RANGE;
+
+// Index of the biggest of the n values (the first one if there's a tie)
+int argmax(const double* values, int n) {
+	int best = 0;
+	for (int i = 1; i < n; ++i) {
+		if (values[i] > values[best]) best = i;
+	}
+	return best;
+}
+
+// Predicts a spread of inputs like the students would see on a rows x cols grid, once with network and
+// once with its reduced-precision copy, and returns the fraction where they'd pick a different direction.
+double precisionMismatchRate(const NeuralNetwork &network, Precision precision, int rows, int cols) {
+	if (precision == PRECISION_DOUBLE) return 0.0;
+	const int SAMPLES = 4096;
+	ReducedNetwork reduced;
+	reduced.copyFrom(network, precision);
+	ReducedNetwork::Workspace reducedWs = reduced.makeWorkspace();
+	NeuralNetwork::Workspace ws = network.makeWorkspace();
+
+	// a fixed sequence instead of rand(), so checking doesn't change the rest of the run
+	unsigned long long state = 0x9E3779B97F4A7C15ULL;
+	auto next = [&state](int n) {
+		state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+		return (int)((state >> 33) % (unsigned long long)n);
+	};
+	int mismatches = 0;
+	for (int s = 0; s < SAMPLES; ++s) {
+		double inputs[4] = {(double)next(rows) / rows, (double)next(cols) / cols, (double)next(rows) / rows, (double)next(cols) / cols};
+		int expected = argmax(network.predict(inputs, ws), network.outputSize());
+		if (argmax(reduced.predict(inputs, reducedWs), reduced.outputSize()) != expected) mismatches++;
+	}
+	return (double)mismatches / SAMPLES;
+}
+
+// ==========================================
+//              POLICY CACHE
+// ==========================================
+// The network inputs are just (x, y, targetX, targetY) divided by the grid size, so there is only a
+// limited set of them, and the weights don't change at all while a generation is being simulated.
+// This remembers the prediction for every input it has seen, until the network's version changes.
+// Small grids get a dense table with one entry per space; big grids get a fixed-size hash table.
+class PolicyCache {
+	public:
+		static const long long DENSE_LIMIT = 1 << 16; // grids with up to this many spaces use the dense table
+		static const int HASH_SLOTS = 1 << 18;        // entries in the hash table for bigger grids
+		static const int MAX_PROBES = 16;             // give up on a lookup/insert after this many slots
+
+		long long hits = 0;   // predictions answered from the cache
+		long long misses = 0; // predictions that had to go through the network
+
+		void setup(int gridRows, int gridCols, int outputs) {
+			cols = gridCols;
+			numOutputs = outputs;
+			dense = (long long)gridRows * gridCols <= DENSE_LIMIT;
+			size_t slots = dense ? (size_t)gridRows * gridCols : (size_t)HASH_SLOTS;
+			keys.assign(slots, 0);
+			epochs.assign(slots, 0);
+			values.assign(slots * numOutputs, 0.0);
+			epoch = 1;
+			version = ~0ULL; // the first sync() always starts fresh
+		}
+
+		// Throws everything away if the network has been trained since the cache was filled
+		void sync(unsigned long long networkVersion) {
+			if (networkVersion == version) return;
+			version = networkVersion;
+			if (++epoch == 0) {
+				// the epoch wrapped around, so old entries could look valid again
+				std::fill(epochs.begin(), epochs.end(), 0);
+				epoch = 1;
+			}
+		}
+
+		// Returns the remembered prediction for these inputs, or nullptr if there isn't one.
+		// Only reads the cache, so it's safe to call from every worker at once.
+		const double* find(int x, int y, int tx, int ty) const {
+			unsigned long long key = makeKey(x, y, tx, ty);
+			if (dense) {
+				size_t slot = (size_t)x * cols + y;
+				return (epochs[slot] == epoch && keys[slot] == key) ? &values[slot * numOutputs] : nullptr;
+			}
+			size_t slot = hashSlot(key);
+			for (int probe = 0; probe < MAX_PROBES && epochs[slot] == epoch; ++probe) {
+				if (keys[slot] == key) return &values[slot * numOutputs];
+				slot = (slot + 1) & (HASH_SLOTS - 1);
+			}
+			return nullptr;
+		}
+
+		// Remembers a prediction. If the hash table is too crowded around this key, it's just not stored.
+		void insert(int x, int y, int tx, int ty, const double* prefs) {
+			unsigned long long key = makeKey(x, y, tx, ty);
+			size_t slot;
+			if (dense) {
+				slot = (size_t)x * cols + y;
+			}
+			else {
+				slot = hashSlot(key);
+				int probe = 0;
+				while (epochs[slot] == epoch && keys[slot] != key) {
+					if (++probe == MAX_PROBES) return;
+					slot = (slot + 1) & (HASH_SLOTS - 1);
+				}
+			}
+			keys[slot] = key;
+			epochs[slot] = epoch;
+			std::copy(prefs, prefs + numOutputs, &values[slot * numOutputs]);
+		}
+
+	private:
+		bool dense = true;
+		int cols = 0;
+		int numOutputs = 0;
+		unsigned epoch = 1;                   // an entry is only valid if its epoch matches this
+		unsigned long long version = ~0ULL;   // network version the entries were predicted with
+		std::vector<unsigned long long> keys; // the inputs each entry was predicted for
+		std::vector<unsigned> epochs;
+		std::vector<double> values;           // numOutputs predictions per entry
 
-char grid[GRID_SIZE][GRID_SIZE]; // stores the actual map for the grid
-int visited_count[GRID_SIZE][GRID_SIZE] = {0};  // stores how much times a space has been visited in a grid
-int actualFriendX, actualFriendY; // stores actual location of the Friend
+		// Every coordinate fits in 16 bits (see MAX_GRID_SIZE), so the four of them fit in one key
+		static unsigned long long makeKey(int x, int y, int tx, int ty) {
+			return (unsigned long long)x << 48 | (unsigned long long)y << 32 | (unsigned long long)tx << 16 | (unsigned long long)ty;
+		}
+
+		static size_t hashSlot(unsigned long long key) {
+			return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 40) & (HASH_SLOTS - 1);
+		}
+};
 
 // ==========================================
-//              NEURAL NETWORK 
+//             STUDENT LOGIC
 // ==========================================
-class NeuralNetwork {
-	private:
-		// Activation function mapping inputs between values of 0-1
-		static double sigmoid(double x) {
-			return 1 / (1 + exp(-x));
+
+// Struct to track a specific move decision
+struct MoveOption {
+    int x, y;
+    int dirIndex; // 0=Up, 1=Down, 2=Left, 3=Right, -1=None
+};
+
+// Used for the neural network program
+struct HistoryStep {
+    double inputs[4]; // The context seen
+    int bestDir;      // The move that was chosen
+};
+
+// Where a student wants to go this step, worked out before anyone actually moves
+struct MoveIntent {
+	int x, y;          // the space the student wants to move to (the same space if it stays)
+	bool findsFriend;  // true if that space is where the friend is hiding
+};
+
+// What a student has worked out about their move before the neural network gets asked anything
+struct MovePlan {
+	MoveOption options[4]; // the best greedy moves while exploring (there are only 4 directions)
+	int numOptions;        // how many of the options are filled in
+	bool needsPrediction;  // true if the greedy moves are tied, so the network has to break the tie
+	int predictionRow;     // which row of the step's prediction matrix belongs to this student
+	const double* cached;  // the prediction from the policy cache, if it had one
+	MoveIntent intent;     // the move, when it could be decided without the network
+};
+
+// ==========================================
+//             HISTORY ARENA
+// ==========================================
+// Every student's path history for one generation lives in here. Steps are stored in fixed-size
+// chunks handed out by a bump allocator (one atomic counter, so any worker can grab a chunk), and
+// each student links their chunks together. reset() just rewinds the counter, so from the second
+// generation on the memory is reused and nothing gets allocated while stepping.
+// Chunks are kept small, since every student that records anything holds at least one of them: with
+// a few hundred thousand students a bigger chunk is mostly empty space.
+struct HistoryChunk {
+	static const int CAPACITY = 6; // steps per chunk (keeps a chunk at 256 bytes)
+	HistoryStep steps[CAPACITY];
+	int count;          // steps used in this chunk
+	HistoryChunk* next; // the student's next chunk, or nullptr
+};
+
+class HistoryArena {
+	public:
+		static const int BLOCK_CHUNKS = 4096; // chunks allocated at a time when the arena needs to grow
+
+		HistoryArena() = default;
+		HistoryArena(const HistoryArena&) = delete;
+		HistoryArena& operator=(const HistoryArena&) = delete;
+
+		~HistoryArena() {
+			for (HistoryChunk* block : blocks) delete[] block;
 		}
-		
-		// Backpropogation function used for readjusting the weights of the training data
-		static double sigmoidDerivative(double x) {
-			return x * (1.0 - x);
+
+		// Makes sure at least count chunks can be handed out. Call this between steps, never while
+		// workers are grabbing chunks (the block list may grow here).
+		void reserve(size_t count) {
+			while (blocks.size() * BLOCK_CHUNKS < used.load(std::memory_order_relaxed) + count) {
+				blocks.push_back(new HistoryChunk[BLOCK_CHUNKS]);
+			}
 		}
 
-		double learningRate = 0.5; // rate at which the AI learns
+		// Hands out an empty chunk. Safe to call from every worker at once, as long as reserve() made room.
+		HistoryChunk* allocate() {
+			size_t index = used.fetch_add(1, std::memory_order_relaxed);
+			HistoryChunk* chunk = &blocks[index / BLOCK_CHUNKS][index % BLOCK_CHUNKS];
+			chunk->count = 0;
+			chunk->next = nullptr;
+			return chunk;
+		}
+
+		// Forgets every chunk (the memory is kept for the next generation)
+		void reset() {
+			used.store(0, std::memory_order_relaxed);
+		}
+
+	private:
+		std::vector<HistoryChunk*> blocks; // never moved once allocated, so chunk pointers stay valid
+		std::atomic<size_t> used{0};       // chunks handed out since the last reset()
+};
+
+// ==========================================
+//              EXPERIENCE LOG
+// ==========================================
+// An append-only file of successful path histories, so they can be kept across runs and trained on
+// later (see --log-experience and --train-from) without holding them all in memory.
+//
+// The file is a 16 byte header ("CAIEXPLG", format version, 4 spare bytes) followed by chunks. A chunk
+// is a 16 byte header ("CHNK", payload bytes, samples, paths) and a payload of whole paths, so every
+// chunk can be read on its own. A path is written as its grid's rows and cols, then one entry per step,
+// then PATH_END. The inputs of a step are just coordinates divided by the grid size, so the coordinates
+// are stored instead of the doubles, and most steps are written as one byte holding the direction taken
+// plus how far the student moved since the step before (-1, 0 or +1 on each axis). Anything else (the
+// first step of a path, a jump, the friend moving) is written out in full after a STEP_FULL byte.
+// Numbers are stored as LEB128 varints, so a whole step usually takes 1 byte instead of the 40 of a HistoryStep.
+//
+// Writing happens on a background thread: paths are encoded into a chunk buffer, and full chunks are
+// queued for the writer, so the simulation never waits on the disk (unless MAX_QUEUED chunks pile up).
+struct ExperienceFileHeader {
+	char magic[8];          // "CAIEXPLG"
+	uint32_t formatVersion; // ExperienceLog::FORMAT_VERSION
+	uint32_t reserved;
+};
+
+struct ExperienceChunkHeader {
+	char magic[4];     // "CHNK"
+	uint32_t bytes;    // payload bytes after this header
+	uint32_t samples;  // steps stored in the payload
+	uint32_t paths;    // paths stored in the payload
+};
 
+class ExperienceLog {
 	public:
-	
-		// Represents each individual neuron inside the neural network
-		class Neuron {
-			public:
-				// Initiate variables
-				double* weights;
-				int num_weights;
-				double bias;
-				double output;
-				double delta; // not used within this class, but used when training data.
-				
-				// When this class is instantiated, do the following:
-				Neuron(int num_inputs) : num_weights(num_inputs) {
-					// for now, randomly set the weights and biases of this neuron.
-					weights = new double[num_weights];
-					for (int i = 0; i < num_weights; ++i) {
-						weights[i] = ((double)rand() / RAND_MAX) - 0.5;
-					}
-					bias = ((double)rand() / RAND_MAX) - 0.5;
-				}
+		static const uint32_t FORMAT_VERSION = 1;
+		static const size_t CHUNK_BYTES = 1 << 16; // a chunk is handed to the writer once it's at least this big
+		static const int MAX_QUEUED = 8;           // chunks waiting for the writer before endPath() waits too
+		static const uint8_t STEP_FULL = 0x40;     // OR'd with the direction: the full coordinates follow
+		static const uint8_t PATH_END = 0xFF;
 
-				~Neuron() {
-					// Free up memory
-					delete[] weights;
-				}
+		long long samples = 0; // steps logged so far
+		long long paths = 0;   // paths logged so far
 
-				double activate(double* inputs) {
-					// consider this the output of this neuron.
-					double sum = bias;
-					for (int i = 0; i < num_weights; ++i) {
-						sum += inputs[i] * weights[i];
-					}
-					output = NeuralNetwork::sigmoid(sum); // evaluate the output between the inputs based on the weights and bias
-					return output;
-				}
-		};
-		
-		// Represents each layer inside the neural network
-		class Layer {
-			public:
-				// Initiate variables
-				Neuron** neurons; // create a dynamic array of neurons
-				int num_neurons;
-				
-				// Create all the necessary neurons for this layer.
-				Layer(int num_neurons_, int num_inputs_per_neuron) : num_neurons(num_neurons_) {
-					neurons = new Neuron * [num_neurons];
-					for (int i = 0; i < num_neurons; ++i) {
-						// Each neuron is created with the proper inputs per neuron
-						neurons[i] = new Neuron(num_inputs_per_neuron);
-					}
-				}
+		static ExperienceLog* open(const std::string& path); // (defined after ExperienceReader, which it uses)
 
-				~Layer() {
-					// free up all the neurons. make sure to delete all the neurons in the array.
-					for (int i = 0; i < num_neurons; ++i) {
-						delete neurons[i];
-					}
-					delete[] neurons;
-				}
-				
-				// outputting all the neurons 
-				double* feedForward(double* inputs) {
-					double* outputs = new double[num_neurons];
-					for (int i = 0; i < num_neurons; ++i) {
-						// iterate through each neuron inside this layer and call the sigmoid function inside them.
-						outputs[i] = neurons[i]->activate(inputs);
-					}
-					
-					// return all the outputs.
-					return outputs; // note: make sure to call the delete[] when using this!
-				}
-		};
-		
-		// Creation of variables for the layers of the neural network
-		Layer** layers;
-		int num_layers;
+		// Writes whatever is still buffered and waits for the writer (see close())
+		~ExperienceLog() { close(); }
 
-		// Instantiate all the layers and the number of neurons inside each layer.
-		NeuralNetwork(int* topology, int size) : num_layers(size - 1) {
-			layers = new Layer * [num_layers];
-			for (int i = 0; i < num_layers; ++i) {
-				// create all the layers and the necessary neurons and input for it
-				layers[i] = new Layer(topology[i + 1], topology[i]);
+		ExperienceLog(const ExperienceLog&) = delete;
+		ExperienceLog& operator=(const ExperienceLog&) = delete;
+
+		static bool validHeader(const ExperienceFileHeader& header) {
+			return memcmp(header.magic, "CAIEXPLG", 8) == 0 && header.formatVersion == FORMAT_VERSION;
+		}
+
+		// Starts a path walked on a rows x cols grid. Every addStep() until endPath() belongs to it.
+		void beginPath(int rows, int cols) {
+			pathRows = rows;
+			pathCols = cols;
+			havePrevious = false;
+			putVarint((uint32_t)rows);
+			putVarint((uint32_t)cols);
+		}
+
+		void addStep(const HistoryStep& step) {
+			int x = (int)std::lround(step.inputs[0] * pathRows);
+			int y = (int)std::lround(step.inputs[1] * pathCols);
+			int tx = (int)std::lround(step.inputs[2] * pathRows);
+			int ty = (int)std::lround(step.inputs[3] * pathCols);
+			int dx = x - lastX, dy = y - lastY;
+			if (havePrevious && tx == lastTX && ty == lastTY && dx >= -1 && dx <= 1 && dy >= -1 && dy <= 1) {
+				filling.push_back((uint8_t)(step.bestDir | (dx + 1) << 2 | (dy + 1) << 4));
+			}
+			else {
+				filling.push_back((uint8_t)(STEP_FULL | step.bestDir));
+				putVarint((uint32_t)x);
+				putVarint((uint32_t)y);
+				putVarint((uint32_t)tx);
+				putVarint((uint32_t)ty);
 			}
+			lastX = x; lastY = y; lastTX = tx; lastTY = ty;
+			havePrevious = true;
+			chunkSamples++;
+			samples++;
 		}
 
-		// Free up the memory and delete all the layers.
-		~NeuralNetwork() {
-			for (int i = 0; i < num_layers; ++i) {
-				delete layers[i];
+		// Finishes the path, and hands the chunk to the writer once it's big enough
+		void endPath() {
+			filling.push_back(PATH_END);
+			chunkPaths++;
+			paths++;
+			if (filling.size() >= CHUNK_BYTES) flushChunk();
+		}
+
+		// Hands the paths logged so far to the writer, even if the chunk isn't full yet
+		// (called at the end of every round, so a run that gets killed only loses its last round)
+		void flush() { flushChunk(); }
+
+		// Writes everything that's left and waits for the writer to finish.
+		// Returns false if anything couldn't be written. Safe to call more than once.
+		bool close() {
+			if (writer.joinable()) {
+				flushChunk();
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					stopping = true;
+				}
+				queueChanged.notify_all();
+				writer.join();
+				out.close();
 			}
-			delete[] layers;
+			return !failed;
 		}
-		
-		// Based on the neural network, predict and evaluate the right output value based on the input.
-		double* predict(double* inputs, int input_size) {
-			
-			// Create the array of inputs and their correct size
-			double* current_inputs = new double[input_size];
-			for (int i = 0; i < input_size; ++i)
-			{
-				current_inputs[i] = inputs[i];
+
+	private:
+		std::ofstream out;
+		std::thread writer;
+		std::mutex mutex;
+		std::condition_variable queueChanged;  // signalled when a chunk is queued or written (or we're stopping)
+		std::vector<std::vector<uint8_t>> queue; // chunks waiting to be written, oldest first
+		std::vector<std::vector<uint8_t>> spare; // written chunks, kept so their memory gets reused
+		bool stopping = false;
+		bool failed = false;                     // set by the writer if a write didn't go through
+
+		std::vector<uint8_t> filling;            // the chunk being encoded (starts with room for its header)
+		uint32_t chunkSamples = 0, chunkPaths = 0;
+		int pathRows = 0, pathCols = 0;
+		int lastX = 0, lastY = 0, lastTX = 0, lastTY = 0;
+		bool havePrevious = false;
+
+		ExperienceLog() { startChunk(); }
+
+		void startChunk() {
+			filling.clear();
+			filling.resize(sizeof(ExperienceChunkHeader));
+			chunkSamples = chunkPaths = 0;
+		}
+
+		void putVarint(uint32_t value) {
+			while (value >= 0x80) {
+				filling.push_back((uint8_t)(value | 0x80));
+				value >>= 7;
 			}
-			
-			// Iterate through each layer and feed them the input.
-			for (int l = 0; l < num_layers; ++l) {
-				// get the output from feeding the inputs to the layers, then set the current input the output value.
-				double* outputs = layers[l]->feedForward(current_inputs);
-				if (l > 0) 
+			filling.push_back((uint8_t)value);
+		}
+
+		// Fills in the chunk's header, queues it for the writer and starts the next one in a spare buffer
+		void flushChunk() {
+			if (chunkPaths == 0) return;
+			ExperienceChunkHeader header;
+			memcpy(header.magic, "CHNK", 4);
+			header.bytes = (uint32_t)(filling.size() - sizeof(header));
+			header.samples = chunkSamples;
+			header.paths = chunkPaths;
+			memcpy(filling.data(), &header, sizeof(header));
+
+			std::unique_lock<std::mutex> lock(mutex);
+			queueChanged.wait(lock, [this] { return (int)queue.size() < MAX_QUEUED; });
+			queue.push_back(std::vector<uint8_t>());
+			queue.back().swap(filling);
+			if (!spare.empty()) {
+				filling.swap(spare.back());
+				spare.pop_back();
+			}
+			lock.unlock();
+			queueChanged.notify_all();
+			startChunk();
+		}
+
+		void writerLoop() {
+			std::vector<uint8_t> chunk;
+			while (true) {
 				{
-					delete[] current_inputs;
+					std::unique_lock<std::mutex> lock(mutex);
+					if (!chunk.empty()) spare.push_back(std::move(chunk)); // hand the last written buffer back
+					queueChanged.wait(lock, [this] { return stopping || !queue.empty(); });
+					if (queue.empty()) return; // stopping, and everything is written
+					chunk.swap(queue.front());
+					queue.erase(queue.begin());
 				}
-				current_inputs = outputs;
+				queueChanged.notify_all(); // there's room in the queue again
+				out.write(reinterpret_cast<const char*>(chunk.data()), (std::streamsize)chunk.size());
+				out.flush();
+				if (!out) failed = true;
 			}
-			
-			// Return the predicted value
-			return current_inputs; // make sure to handle deletion of the output here !
 		}
-		
-		// Adjust for the neural network's ACTUAL weights and biases based on the expected value and trained data.
-		void train(double* inputs, double* expected, int input_size) {
-			double* outputs = predict(inputs, input_size); // to get the initial evaluation of the inputs
+};
 
-			// Compute delta/error for each neuron in the output layer
-			Layer* outputLayer = layers[num_layers - 1];
-			for (int i = 0; i < outputLayer->num_neurons; ++i) {
-				// access each neuron's delta and compute the necessary adjustments based on the output, expected and the sigmoid
-				double out = outputLayer->neurons[i]->output;
-				outputLayer->neurons[i]->delta = (expected[i] - out) * sigmoidDerivative(out);
+const uint8_t ExperienceLog::STEP_FULL;
+const uint8_t ExperienceLog::PATH_END;
+
+// Reads an experience log back one chunk at a time, as training samples: the same inputs the students
+// saw, and the direction they took as a one-hot expected output (like the training phase builds them).
+class ExperienceReader {
+	public:
+		static const uint32_t MAX_CHUNK_BYTES = 1u << 30; // anything claiming to be bigger is damage, not a chunk
+
+		long long paths = 0; // paths read so far
+
+		// Returns nullptr if the file is missing or isn't an experience log
+		static ExperienceReader* open(const std::string& path) {
+			ExperienceReader* reader = new ExperienceReader();
+			reader->in.open(path, std::ios::binary);
+			ExperienceFileHeader header;
+			if (!reader->in.read(reinterpret_cast<char*>(&header), sizeof(header)) || !ExperienceLog::validHeader(header)) {
+				delete reader;
+				return nullptr;
 			}
+			return reader;
+		}
 
-			// Compute delta/error for each neuron in the hidden layers
-			for (int l = num_layers - 2; l >= 0; --l) {
-				Layer* current = layers[l];
-				Layer* next = layers[l + 1];
-				for (int i = 0; i < current->num_neurons; ++i) {
-					// access each neuron's delta and compute the necessary adjustments based on errors of the NEXT layers
-					double error = 0.0;
-					for (int j = 0; j < next->num_neurons; ++j) {
-						// we also gradually compute the adjustments for the next layer.
-						error += next->neurons[j]->weights[i] * next->neurons[j]->delta;
-					}
-					current->neurons[i]->delta = error * sigmoidDerivative(current->neurons[i]->output);
+		// Goes back to the first sample
+		void rewind() {
+			in.clear();
+			in.seekg(sizeof(ExperienceFileHeader));
+			chunk.clear();
+			pos = 0;
+			inPath = false;
+			paths = 0;
+			goodEnd = sizeof(ExperienceFileHeader);
+		}
+
+		// Reads up to maxSamples samples into inputs (4 per sample) and expected (4 per sample).
+		// Returns how many were read, 0 once the log is used up. Damaged chunks (cut short by a run that
+		// was killed, say) are skipped: reading picks up again at the next chunk that checks out.
+		int read(double* inputs, double* expected, int maxSamples) {
+			int count = 0;
+			while (count < maxSamples) {
+				if (pos >= chunk.size() && !nextChunk()) break;
+				// nextChunk() already made sure the chunk decodes, so nothing here can run off its end
+				if (!inPath) {
+					rows = (int)getVarint();
+					cols = (int)getVarint();
+					inPath = true;
+					continue;
+				}
+				uint8_t code = chunk[pos++];
+				if (code == ExperienceLog::PATH_END) {
+					inPath = false;
+					paths++;
+					continue;
+				}
+				int dir = code & 3;
+				if (code & ExperienceLog::STEP_FULL) {
+					x = (int)getVarint();
+					y = (int)getVarint();
+					tx = (int)getVarint();
+					ty = (int)getVarint();
+				}
+				else {
+					x += ((code >> 2) & 3) - 1;
+					y += ((code >> 4) & 3) - 1;
 				}
+				double* in = inputs + (size_t)count * 4;
+				in[0] = (double)x / rows; // the same divisions fillInputs() does, so the inputs come back exactly
+				in[1] = (double)y / cols;
+				in[2] = (double)tx / rows;
+				in[3] = (double)ty / cols;
+				double* ex = expected + (size_t)count * 4;
+				for (int d = 0; d < 4; ++d) ex[d] = (d == dir) ? 1.0 : 0.0;
+				count++;
 			}
+			return count;
+		}
 
-			// Update the weights and biases in each layers neurons
-			for (int l = 0; l < num_layers; ++l) {
-				Layer* layer = layers[l];
-				double* layerInputs;
-				int num_inputs;
-				
-				
-				if (l == 0) {
-					// IF WE ARE AT THE INPUT LAYER
-					layerInputs = inputs;
-					num_inputs = input_size;
+		// Bytes from the start of the file to the end of its last good chunk. Anything after that is a
+		// chunk that was cut short, which ExperienceLog::open() cuts off before appending.
+		static long long validLength(const std::string& path) {
+			ExperienceReader* reader = open(path);
+			if (!reader) return -1;
+			while (reader->nextChunk()) {}
+			long long end = reader->goodEnd;
+			delete reader;
+			return end;
+		}
+
+	private:
+		std::ifstream in;
+		std::vector<uint8_t> chunk; // the payload of the chunk being read
+		size_t pos = 0;             // next byte to decode in chunk
+		bool inPath = false;
+		bool bad = false;           // a varint ran off the end of the chunk
+		long long goodEnd = sizeof(ExperienceFileHeader); // where the last good chunk ends in the file
+		int rows = 1, cols = 1, x = 0, y = 0, tx = 0, ty = 0;
+
+		// Loads the next chunk that checks out, skipping over anything damaged. Returns false at the end.
+		bool nextChunk() {
+			while (true) {
+				long long start = (long long)in.tellg();
+				if (start < 0) return false;
+				ExperienceChunkHeader header;
+				if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))) return false;
+				bool ok = memcmp(header.magic, "CHNK", 4) == 0 && header.bytes <= MAX_CHUNK_BYTES;
+				if (ok) {
+					chunk.resize(header.bytes);
+					ok = (bool)in.read(reinterpret_cast<char*>(chunk.data()), header.bytes) && checkChunk(header);
 				}
-				else {
-					// IF WE ARE AT THE HIDDEN/OUTPUT LAYERS
-					Layer* prevLayer = layers[l - 1];
-					num_inputs = prevLayer->num_neurons;
-					layerInputs = new double[num_inputs];
-					for (int i = 0; i < num_inputs; ++i)
-					{
-						// store the outputs of each neuron inside the layerInputs.
-						layerInputs[i] = prevLayer->neurons[i]->output;
-					}
+				pos = 0;
+				inPath = false;
+				if (ok) {
+					goodEnd = start + (long long)sizeof(header) + header.bytes;
+					return true;
 				}
-				
-				 
-				for (int n = 0; n < layer->num_neurons; ++n) {
-					// adjust the weights and bias of each neuron now that we have computed the delta.
-					Neuron* neuron = layer->neurons[n];
-					for (int w = 0; w < neuron->num_weights; ++w) 
-					{
-						// compute the weights based on learning rate, delta, and the layers output
-						neuron->weights[w] += learningRate * neuron->delta * layerInputs[w];
+				chunk.clear();
+				if (!resync(start + 1)) return false;
+			}
+		}
+
+		// Decodes the whole chunk without keeping anything, to make sure it's all there and matches its
+		// header (a chunk that was cut short and then appended to would have the next chunk's bytes in it)
+		bool checkChunk(const ExperienceChunkHeader& header) {
+			pos = 0;
+			bad = false;
+			uint32_t samples = 0, pathsFound = 0;
+			while (pos < chunk.size() && !bad) {
+				uint32_t pathRows = getVarint(), pathCols = getVarint();
+				if (bad || pathRows == 0 || pathCols == 0) return false;
+				while (true) {
+					if (pos >= chunk.size()) return false;
+					uint8_t code = chunk[pos++];
+					if (code == ExperienceLog::PATH_END) break;
+					if (code & ~(ExperienceLog::STEP_FULL | 0x3F)) return false;
+					if (code & ExperienceLog::STEP_FULL) {
+						for (int k = 0; k < 4; ++k) getVarint();
+						if (bad) return false;
 					}
-					neuron->bias += learningRate * neuron->delta;
+					samples++;
 				}
+				pathsFound++;
+			}
+			return !bad && samples == header.samples && pathsFound == header.paths;
+		}
 
-				if (l != 0) 
-				{
-					// if this is the input layer, just delete this.
-					delete[] layerInputs;
+		// Moves the file to the next "CHNK" at or after offset. Returns false if there isn't one.
+		bool resync(long long offset) {
+			in.clear();
+			in.seekg(offset);
+			const char* magic = "CHNK";
+			int matched = 0;
+			char c;
+			while (in.get(c)) {
+				offset++;
+				matched = (c == magic[matched]) ? matched + 1 : (c == magic[0] ? 1 : 0);
+				if (matched == 4) {
+					in.seekg(offset - 4);
+					return true;
 				}
 			}
-		
-		// clear up the memory now that we don't need to store this data
-		delete[] outputs;
-	}
+			return false;
+		}
+
+		uint32_t getVarint() {
+			uint32_t value = 0;
+			for (int shift = 0; shift < 35; shift += 7) {
+				if (pos >= chunk.size()) break;
+				uint8_t byte = chunk[pos++];
+				value |= (uint32_t)(byte & 0x7F) << shift;
+				if (!(byte & 0x80)) return value;
+			}
+			bad = true;
+			return 0;
+		}
 };
 
-NeuralNetwork* sharedBrain = nullptr; // brain to be used by all the students
+// Opens a log for appending, creating it if it doesn't exist. Returns nullptr if the file can't be
+// opened, or already holds something that isn't an experience log. A chunk left cut short at the end
+// by a run that didn't finish is cut off first, so what gets appended stays readable.
+ExperienceLog* ExperienceLog::open(const std::string& path) {
+	ExperienceFileHeader header;
+	bool exists = false;
+	{
+		std::ifstream in(path, std::ios::binary);
+		if (in && in.peek() != std::ifstream::traits_type::eof()) {
+			exists = true;
+			if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) || !validHeader(header)) return nullptr;
+		}
+	}
+	if (exists) {
+		long long end = ExperienceReader::validLength(path);
+		if (end < 0) return nullptr;
+		std::error_code error;
+		uintmax_t size = std::filesystem::file_size(path, error);
+		if (!error && size > (uintmax_t)end) std::filesystem::resize_file(path, (uintmax_t)end, error);
+		if (error) return nullptr;
+	}
+	ExperienceLog* log = new ExperienceLog();
+	log->out.open(path, std::ios::binary | std::ios::app);
+	if (log->out && !exists) {
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, "CAIEXPLG", 8);
+		header.formatVersion = FORMAT_VERSION;
+		log->out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	}
+	if (!log->out) {
+		delete log;
+		return nullptr;
+	}
+	log->writer = std::thread([log] { log->writerLoop(); });
+	return log;
+}
 
 // ==========================================
-//             STUDENT LOGIC
+//            STUDENT POPULATION
 // ==========================================
+// All the students, stored as parallel arrays (struct of arrays) instead of one object per student,
+// so a pass over every student's position or state walks straight through memory.
+// Student i is posX[i], posY[i], knowsFriend[i] and so on.
+class StudentPopulation {
+	public:
+		std::vector<int> posX, posY;                  // where each student is
+		std::vector<unsigned char> knowsFriend;       // 1 if the student found the friend
+		std::vector<int> frontierX, frontierY;        // unexplored space each student is heading for (-1 = none yet)
+		std::vector<unsigned short> frontierWait;     // steps left of plain greedy exploring after getting stuck on a wall
+		std::vector<HistoryChunk*> historyHead;       // first chunk of each student's path history
+		std::vector<HistoryChunk*> historyTail;       // chunk the next history step goes into
+		HistoryArena history;                         // memory for all the path histories
+		World* world = nullptr;                       // the maze these students are in
+		int atTarget = 0;                             // students standing on the gathering place right now
+		bool useFrontier = true;                      // if false, exploring is only the greedy visit count
+		static const int FRONTIER_WAIT = 4; // greedy steps taken after getting stuck on the way to the frontier
 
-// Struct to track a specific move decision
-struct MoveOption {
-    int x, y;
-    int dirIndex; // 0=Up, 1=Down, 2=Left, 3=Right, -1=None
-};
+		int size() const { return (int)posX.size(); }
 
-// Used for the neural network program
-struct HistoryStep {
-    double inputs[4]; // The context seen
-    int bestDir;      // The move that was chosen
-};
+		// True once every student is at the gathering place. atTarget is kept up to date by enterCell(),
+		// so this doesn't have to look at any student.
+		bool allGathered() const { return atTarget == size(); }
 
-class Student{
-	public:
-		// defining variables to be used for the student class
-		int x,y;
-		bool knowsFriend = false;
-		std::vector<HistoryStep> pathHistory; // Remember path for training, used for the neural network
-		
-		// Called when the students' location needs to be updated ( usually preceded by tryMove() )
-		void updateLocation(int newX, int newY, int knownFX, int knownFY){
-			if (grid[x][y] == STUDENTS)
+		// Gets the population ready for a new generation of count students. The arrays keep their
+		// memory between generations, and the arena is rewound.
+		void reset(int count) {
+			posX.assign(count, 0);
+			posY.assign(count, 0);
+			knowsFriend.assign(count, 0);
+			frontierX.assign(count, -1);
+			frontierY.assign(count, -1);
+			frontierWait.assign(count, 0);
+			historyHead.assign(count, nullptr);
+			historyTail.assign(count, nullptr);
+			atTarget = 0;
+			history.reset(); // nothing is set aside yet, a student gets their first chunk on their first step
+		}
+
+		// Makes sure every student can add one more step to their history without the arena growing.
+		// Only the students without a chunk or with a full one would need a new chunk.
+		void reserveStep() {
+			size_t needed = 0;
+			for (size_t i = 0; i < historyTail.size(); ++i) {
+				const HistoryChunk* tail = historyTail[i];
+				if (!tail || tail->count == HistoryChunk::CAPACITY) needed++;
+			}
+			history.reserve(needed);
+		}
+
+		// Puts a new student on the grid for the first time
+		void spawn(int i, int newX, int newY) {
+			Grid &grid = world->grid;
+			bool atFriend = (newX == world->friendX && newY == world->friendY);
+			posX[i] = newX;
+			posY[i] = newY;
+			if (atFriend) atTarget++;
+			grid.visit(newX, newY);
+			grid.set(newX, newY, atFriend ? GATHER : STUDENTS);
+		}
+
+		// Called when a student's location needs to be updated
+		void updateLocation(int i, int newX, int newY) {
+			leaveCell(i);
+			enterCell(i, newX, newY);
+		}
+
+		// Takes the student's marker off of the space they are leaving
+		void leaveCell(int i) {
+			Grid &grid = world->grid;
+			if (grid.at(posX[i], posY[i]) == STUDENTS)
 			{
-				grid[x][y] = SPACE; // used to handle errors in case when 2 students happen to be in the same space
+				grid.set(posX[i], posY[i], SPACE); // used to handle errors in case when 2 students happen to be in the same space
 			}
+		}
+
+		// Set the new x and y coordinate positions, and update the visited count (and the gathered count).
+		void enterCell(int i, int newX, int newY) {
+			Grid &grid = world->grid;
+			bool atFriend = (newX == world->friendX && newY == world->friendY);
+			if (posX[i] == world->friendX && posY[i] == world->friendY) atTarget--;
+			if (atFriend) atTarget++;
+			posX[i] = newX;
+			posY[i] = newY;
+			grid.visit(newX, newY); 
 			
-			// Set the new x and y coordinate positions, and update the visited count.
-			x = newX;
-			y = newY;
-			visited_count[x][y]++; 
-			
-			(x == actualFriendX && y == actualFriendY) ? grid[x][y] = GATHER : grid[x][y] = STUDENTS; // if true, student is at the gathering place
+			grid.set(newX, newY, atFriend ? GATHER : STUDENTS); // if true, student is at the gathering place
 		}
 
-		bool tryMove(bool friendFound, int knownFX, int knownFY) {
-			int nextX = x; // set initial position for x coordinate 
-			int nextY = y; // set initial position for y coordinate 
-			int chosenDir = -1; // For recording history
+		// Prepare Inputs for NN (Normalized 0.0 - 1.0)
+		void fillInputs(int i, double* inputs, int knownFX, int knownFY) const {
+			const Grid &grid = world->grid;
+			inputs[0] = (double)posX[i] / grid.rows;
+			inputs[1] = (double)posY[i] / grid.cols;
+			inputs[2] = (double)knownFX / grid.rows;
+			inputs[3] = (double)knownFY / grid.cols;
+		}
 
-			// Prepare Inputs for NN (Normalized 0.0 - 1.0)
-			double inputs[4];
-			inputs[0] = (double)x / GRID_SIZE;
-			inputs[1] = (double)y / GRID_SIZE;
-			inputs[2] = (double)knownFX / GRID_SIZE;
-			inputs[3] = (double)knownFY / GRID_SIZE;
-			
-			// Get NN Prediction (Preferences for Up, Down, Left, Right)
-			double* nnPrefs = sharedBrain->predict(inputs, 4);
+		// Adds a step to the end of the student's path history (grabs a new chunk when the last one is full)
+		void recordStep(int i, const HistoryStep &step) {
+			HistoryChunk* tail = historyTail[i];
+			if (!tail || tail->count == HistoryChunk::CAPACITY) {
+				HistoryChunk* chunk = history.allocate();
+				if (tail) tail->next = chunk;
+				else historyHead[i] = chunk;
+				historyTail[i] = tail = chunk;
+			}
+			tail->steps[tail->count++] = step;
+		}
+
+		// Calls fn(step) for every step in the student's path history, oldest first
+		template <class Fn>
+		void forEachStep(int i, Fn fn) const {
+			for (const HistoryChunk* chunk = historyHead[i]; chunk; chunk = chunk->next) {
+				for (int s = 0; s < chunk->count; ++s) fn(chunk->steps[s]);
+			}
+		}
+
+		// First half of a move. Works out everything that doesn't need the neural network: the whole gathering
+		// move, or the list of best greedy moves while exploring. Only if there's a tie between greedy moves does
+		// the plan ask for a prediction, everything else gets decided right here.
+		// This only reads the grid as it was at the start of the step and doesn't change anything,
+		// so every student can plan at the same time.
+		void planMove(int i, bool friendFound, int knownFX, int knownFY, MovePlan &plan) {
+			const Grid &grid = world->grid;
+			int x = posX[i], y = posY[i];
+			plan.intent = {x, y, false}; // stay put unless we find somewhere to go
+			plan.numOptions = 0;
+			plan.needsPrediction = false;
 
 			if (friendFound) {
-				// --- IF FRIEND IS FOUND : GATHERING BEHAVIOR (Standard Greedy) ---
+				// --- IF FRIEND IS FOUND : GATHERING BEHAVIOR (follow the distance field) ---
 				int idealX = x, idealY = y;
 				if (x != knownFX) idealX += (x < knownFX) ? 1 : -1; // move towards the friend's X coordinates
 				if (y != knownFY) idealY += (y < knownFY) ? 1 : -1; // move towards the friend's Y coordinates
 				
-				// check if the move is within the confines of the grid, and is not a wall
-				bool idealMoveValid = (idealX >= 0 && idealX < GRID_SIZE && idealY >= 0 && idealY < GRID_SIZE && grid[idealX][idealY] != WALL);
-				
-				if (idealMoveValid) 
+				// take the straight move when it's on a shortest path, otherwise go around the walls.
+				// If there's no way to the friend at all, just stay put.
+				int nextX, nextY;
+				if (world->friendDistance.nextStep(x, y, idealX, idealY, nextX, nextY)) 
 				{
-					// if ideal move is valid, proceed.
-					nextX = idealX; nextY = idealY;
-				} 
-				else 
-				{
-					// Fallback: Random wiggle if blocked
-					 do {
-						nextX = x + (rand() % 3) - 1; 
-						nextY = y + (rand() % 3) - 1; 
-					} while ( (nextX != x || nextY != y) && (nextX < 0 || nextX >= GRID_SIZE || nextY < 0 || nextY >= GRID_SIZE || grid[nextX][nextY] == WALL) );
+					plan.intent = {nextX, nextY, false};
 				}
+				return;
 			} 
-			else 
-			{
-				// --- GREEDY EXPLORATION + NEURAL GUIDANCE ---
-				int minVisits = 99999;
-				std::vector<MoveOption> bestMoves; // create a list of best moves for the student to take
-
-				// Map standard loops to direction indices for the NN
-				// Indices: 0:Up (-1,0), 1:Down (1,0), 2:Left (0,-1), 3:Right (0,1)
-				int dX[4] = {-1, 1, 0, 0};
-				int dY[4] = {0, 0, -1, 1};
-
-				// Check for the 4 cardinal directions, then count the visits (simplified for NN mapping)
-				for(int i=0; i<4; i++) {
-					// update the positions for x and y
-					int checkX = x + dX[i];
-					int checkY = y + dY[i];
-					
-					// Check for space validity
-					if (checkX >= 0 && checkX < GRID_SIZE && checkY >= 0 && checkY < GRID_SIZE && grid[checkX][checkY] != WALL) 
+
+			// --- GREEDY EXPLORATION + NEURAL GUIDANCE ---
+			int minVisits = 99999;
+			MoveOption* bestMoves = plan.options; // create a list of best moves for the student to take (there are only 4 directions)
+			int numBestMoves = 0;
+
+			// Map standard loops to direction indices for the NN
+			// Indices: 0:Up (-1,0), 1:Down (1,0), 2:Left (0,-1), 3:Right (0,1)
+			int dX[4] = {-1, 1, 0, 0};
+			int dY[4] = {0, 0, -1, 1};
+
+			// Check for the 4 cardinal directions, then count the visits (simplified for NN mapping)
+			for(int d=0; d<4; d++) {
+				// update the positions for x and y
+				int checkX = x + dX[d];
+				int checkY = y + dY[d];
+				
+				// Check for space validity
+				if (grid.isOpen(checkX, checkY)) 
+				{
+					// Count the total visit counts for this space
+					int currentVisits = grid.visits(checkX, checkY);
+
+					// Standard Greedy Logic: Find lowest visit count
+					if (currentVisits < minVisits) 
+					{
+						// If this space has been visited less times than the other, reset the list and push this one forward.
+						minVisits = currentVisits;
+						numBestMoves = 0;
+						bestMoves[numBestMoves++] = {checkX, checkY, d};
+					} 
+					else if (currentVisits == minVisits) 
 					{
-						// Count the total visit counts for this space
-						int currentVisits = visited_count[checkX][checkY];
-
-						// Standard Greedy Logic: Find lowest visit count
-						if (currentVisits < minVisits) 
-						{
-							// If this space has been visited less times than the other, reset the list and push this one forward.
-							minVisits = currentVisits;
-							bestMoves.clear();
-							bestMoves.push_back({checkX, checkY, i});
-						} 
-						else if (currentVisits == minVisits) 
-						{
-							// add to the best moves list
-							bestMoves.push_back({checkX, checkY, i});
+						// add to the best moves list
+						bestMoves[numBestMoves++] = {checkX, checkY, d};
+					}
+				}
+			}
+
+			// Frontier: if every space around here has already been walked on, picking the least visited one
+			// just wanders around. Head for the closest space nobody has been to yet instead. When a wall
+			// is in the way, go back to the greedy moves for a while so the student can find a way around
+			// it instead of bouncing back and forth in front of it.
+			if (frontierWait[i] > 0) frontierWait[i]--;
+			else if (useFrontier && numBestMoves > 0 && minVisits > 0) {
+				int &targetX = frontierX[i], &targetY = frontierY[i];
+				// the target is kept until someone visits it, so most steps don't search at all
+				if (targetX < 0 || grid.visits(targetX, targetY) != 0 || grid.at(targetX, targetY) == WALL) {
+					PROFILE_COUNT(COUNTER_FRONTIER_SEARCHES, 1);
+					if (!grid.nearestUnexplored(x, y, targetX, targetY)) targetX = targetY = -1;
+				}
+				if (targetX >= 0) {
+					MoveOption closer[4];
+					int numCloser = 0;
+					int here = std::abs(targetX - x) + std::abs(targetY - y);
+					for (int d = 0; d < 4; d++) {
+						int checkX = x + dX[d], checkY = y + dY[d];
+						if (grid.isOpen(checkX, checkY) && std::abs(targetX - checkX) + std::abs(targetY - checkY) < here) {
+							closer[numCloser++] = {checkX, checkY, d};
 						}
 					}
+					if (numCloser > 0) {
+						std::copy(closer, closer + numCloser, bestMoves);
+						numBestMoves = numCloser;
+					}
+					else {
+						PROFILE_COUNT(COUNTER_FRONTIER_STALLS, 1);
+						targetX = targetY = -1;
+						frontierWait[i] = FRONTIER_WAIT;
+					}
 				}
+			}
+
+			plan.numOptions = numBestMoves;
+			plan.needsPrediction = (numBestMoves > 1); // If we have multiple equally good "Greedy" options, we have to ask the Brain.
+		}
+
+		// Second half of a move. nnPrefs is the neural network's prediction for this student's inputs
+		// (Preferences for Up, Down, Left, Right), and is only given when the plan asked for it.
+		// Records the move in the path history and returns where student i wants to go.
+		MoveIntent finishMove(int i, bool friendFound, int knownFX, int knownFY, const MovePlan &plan, const double* nnPrefs) {
+			if (friendFound || plan.numOptions == 0) return plan.intent; // nothing left to decide
+
+			// HYBRID DECISION:
+			// We have a list of "Best Greedy Moves" (plan.options).
+			// Use the Neural Network to pick the absolute best among them.
+			int bestIndex = 0; // Only one greedy option, take it.
+			double maxConfidence = -1.0;
+
+			if (plan.needsPrediction) 
+			{
+				// Run through all the best moves, and see which one the neural network is most confident in
+				for(int o=0; o < plan.numOptions; o++) 
+				{
+					int dir = plan.options[o].dirIndex;
+					// Use the NN output for this direction as the score
+					if(nnPrefs[dir] > maxConfidence) 
+					{
+						maxConfidence = nnPrefs[dir];
+						bestIndex = o;
+					}
+				}
+			} 
+			
+			// Set the next positions and directions based on whatever the best move the AI found.
+			const MoveOption &best = plan.options[bestIndex];
+
+			// Record History for Training later
+			HistoryStep step;
+			fillInputs(i, step.inputs, knownFX, knownFY);
+			step.bestDir = best.dirIndex;
+			recordStep(i, step); // the arena was reserved before the step, so this doesn't allocate
+
+			// Check if we're going to be finding the friend (the move itself happens in simulationStep)
+			return {best.x, best.y, world->grid.at(best.x, best.y) == FRIEND};
+		}
+};
+
+// Remembers which spaces have already been taken during the current step, so two students that want
+// the same space are sorted out the same way every time. It's a small open-addressing hash table
+// that is emptied by bumping a stamp instead of clearing it.
+class ClaimTable {
+	public:
+		// Makes room for up to n claims per step
+		void reserve(int n) {
+			size_t capacity = 16;
+			while (capacity < (size_t)n * 2) capacity <<= 1;
+			keys.assign(capacity, 0);
+			stamps.assign(capacity, 0);
+			mask = capacity - 1;
+			stamp = 0;
+		}
+
+		// Forgets every claim from the last step
+		void nextStep() {
+			if (++stamp == 0) {
+				// the stamp wrapped around, so old stamps could look new again
+				std::fill(stamps.begin(), stamps.end(), 0);
+				stamp = 1;
+			}
+		}
+
+		// Claims the space with this grid index. Returns false if it was already claimed this step.
+		bool claim(size_t key) {
+			size_t slot = (key * 0x9E3779B97F4A7C15ULL) >> 7 & mask;
+			while (stamps[slot] == stamp) {
+				if (keys[slot] == key) return false;
+				slot = (slot + 1) & mask;
+			}
+			stamps[slot] = stamp;
+			keys[slot] = key;
+			return true;
+		}
+
+	private:
+		std::vector<size_t> keys;
+		std::vector<unsigned> stamps; // a slot is only in use if its stamp matches the current one
+		unsigned stamp = 0;
+		size_t mask = 0;
+};
+
+// Everything simulationStep() needs besides the students. It's set up once and kept between steps,
+// so stepping never has to allocate anything.
+struct StepContext {
+	static const int INFERENCE_BLOCK = 256; // rows each worker pushes through the network at a time
+
+	ThreadPool* pool = nullptr;
+	std::vector<NeuralNetwork::BatchWorkspace> workspaces; // one per worker thread
+	std::vector<double> inputs;                             // network inputs of the students that need a prediction, one row each
+	std::vector<double> prefs;                              // the predicted preferences for those rows
+	std::vector<int> predictFor;                            // which student each of those rows belongs to
+	std::vector<MovePlan> plans;                            // what each student worked out before the network is asked
+	std::vector<MoveIntent> intents;                        // where each student wants to go this step
+	ClaimTable claims;                                      // spaces taken so far this step
+	PolicyCache cache;                                      // predictions remembered from earlier steps
+	long long predictions = 0;                              // rows that actually went through the network
+	long long predictionsSkipped = 0;                       // student moves that didn't need the network at all
+	bool useFastBrain = false;                              // predict with the compile-time sized copy of the brain instead
+	FastBrain fastBrain;                                    // that copy, refreshed whenever the brain learns something
+	std::vector<FastBrain::Workspace> fastWorkspaces;       // one per worker thread
+	Precision precision = PRECISION_DOUBLE;                 // anything else predicts with reducedBrain instead
+	ReducedNetwork reducedBrain;                            // the brain in that precision, rebuilt whenever it learns something
+	std::vector<ReducedNetwork::Workspace> reducedWorkspaces; // one per worker thread
 
-				if (!bestMoves.empty()) {
-					// HYBRID DECISION:
-					// We have a list of "Best Greedy Moves" (bestMoves).
-					// Use the Neural Network to pick the absolute best among them.
-					
-					int bestIndex = 0;
-					double maxConfidence = -1.0;
+	// Called once per generation, the moment the first student finds the friend (with that student's index
+	// and the friend's location). Optional, and called from the thread that called simulationStep().
+	std::function<void(int student, int friendX, int friendY)> onFriendFound;
 
-					// If we have multiple equally good "Greedy" options, ask the Brain.
-					if (bestMoves.size() > 1) 
-					{
-						// Run through all the best moves, and see which one the neural network is most confident in
-						for(int i=0; i < bestMoves.size(); i++) 
-						{
-							int dir = bestMoves[i].dirIndex;
-							// Use the NN output for this direction as the score
-							if(nnPrefs[dir] > maxConfidence) 
-							{
-								maxConfidence = nnPrefs[dir];
-								bestIndex = i;
-							}
-						}
-					} 
-					else 
-					{
-						// Only one greedy option, take it.
-						bestIndex = 0;
-					}
-					
-					// Set the next positions and directions based on whatever the best move the AI found.
-					nextX = bestMoves[bestIndex].x;
-					nextY = bestMoves[bestIndex].y;
-					chosenDir = bestMoves[bestIndex].dirIndex;
-				} 
-			}
+	// Gets everything ready for stepping numStudents students around this world
+	void setup(ThreadPool* threads, int numStudents, World &world) {
+		pool = threads;
+		workspaces.clear();
+		for (int w = 0; w < pool->size(); ++w) workspaces.push_back(sharedBrain->makeBatchWorkspace(INFERENCE_BLOCK));
+		inputs.resize((size_t)numStudents * 4);
+		prefs.resize((size_t)numStudents * sharedBrain->outputSize());
+		predictFor.resize(numStudents);
+		plans.resize(numStudents);
+		intents.resize(numStudents);
+		claims.reserve(numStudents);
+		cache.setup(world.grid.rows, world.grid.cols, sharedBrain->outputSize());
+		world.friendDistance.reserve(world.grid, world.searchQueue);
+		if (useFastBrain) {
+			fastBrain.copyFrom(*sharedBrain);
+			fastWorkspaces.assign(pool->size(), fastBrain.makeWorkspace());
+		}
+		if (precision != PRECISION_DOUBLE) {
+			reducedBrain.copyFrom(*sharedBrain, precision);
+			reducedWorkspaces.assign(pool->size(), reducedBrain.makeWorkspace(INFERENCE_BLOCK));
+		}
+	}
+};
 
-			// Record History for Training later
-			if(chosenDir != -1 && !friendFound) {
-				HistoryStep step;
-				for(int i=0; i<4; i++) 
-				{
-					step.inputs[i] = inputs[i];
-				}
-				
-				step.bestDir = chosenDir;
-				pathHistory.push_back(step);
+// ==========================================
+//             TERMINAL RENDERER
+// ==========================================
+// Draws the grid for interactive mode with ANSI escape codes, which work on Linux, macOS and
+// Windows 10+ terminals alike. It remembers what's already on the screen and only sends the spaces
+// that changed (jumping the cursor to them), builds the whole frame in one buffer and writes it in
+// one go. Frames are also rate limited on their own, so a fast simulation doesn't spend its time
+// printing: frames that come too soon after the last one are skipped.
+class TerminalRenderer {
+	public:
+		static constexpr int MAX_VIEW_ROWS = 40; // only this much of a big grid fits on the screen (from the top left)
+		static constexpr int MAX_VIEW_COLS = 60;
+		static constexpr int GRID_TOP = 3;       // screen line the grid starts on (the status goes on line 1)
+
+		// fps is the most frames drawn per second (0 = draw every frame)
+		explicit TerminalRenderer(int fps) : minFrameGap(fps > 0 ? 1.0 / fps : 0.0) {
+#ifdef _WIN32
+			// older Windows consoles only understand the escape codes when asked to
+			HANDLE console = GetStdHandle(STD_OUTPUT_HANDLE);
+			DWORD mode = 0;
+			if (GetConsoleMode(console, &mode)) SetConsoleMode(console, mode | 0x0004); // ENABLE_VIRTUAL_TERMINAL_PROCESSING
+#endif
+		}
+
+		// Forgets what's on the screen, so the next frame clears it and draws everything again
+		// (call it after printing anything else, since that can scroll the screen)
+		void invalidate() { valid = false; }
+
+		// Draws the grid with a status line above it. Returns false if the frame was skipped because
+		// the last one was too recent (force draws it anyway, e.g. for the last frame of a generation).
+		bool draw(const Grid &map, const std::string &status, bool force) {
+			auto now = std::chrono::steady_clock::now();
+			if (!force && valid && std::chrono::duration<double>(now - lastFrame).count() < minFrameGap) return false;
+			lastFrame = now;
+
+			int viewRows = std::min(map.rows, MAX_VIEW_ROWS);
+			int viewCols = std::min(map.cols, MAX_VIEW_COLS);
+			frame.clear();
+			if (!valid || viewRows != shownRows || viewCols != shownCols) {
+				// start over: clear the screen, and count every space as changed
+				frame.reserve((size_t)viewRows * viewCols * 12 + 256); // enough for a cursor jump before every space
+				frame += "\x1b[2J";
+				shown.assign((size_t)viewRows * viewCols, 0);
+				shownRows = viewRows;
+				shownCols = viewCols;
+				shownStatus.clear();
+				valid = true;
 			}
 
-			delete[] nnPrefs; // Clean up memory
+			if (status != shownStatus) {
+				moveTo(1, 1);
+				frame += status;
+				frame += "\x1b[K"; // clear whatever was left of a longer status
+				shownStatus = status;
+			}
 
-			// EXECUTE MOVE
-			if (nextX != x || nextY != y) 
-			{
-				// Check if we're going to be finding the friend
-				if (grid[nextX][nextY] == FRIEND && !friendFound) 
-				{
-					knowsFriend = true;
-					updateLocation(nextX, nextY, knownFX, knownFY);
-					return true; // Found Friend!
+			// every space is its character and a blank, so after writing one the cursor is already on the next
+			int cursorRow = -1, cursorCol = -1;
+			for (int r = 0; r < viewRows; ++r) {
+				for (int c = 0; c < viewCols; ++c) {
+					char cell = map.at(r, c);
+					char &old = shown[(size_t)r * viewCols + c];
+					if (cell == old) continue;
+					old = cell;
+					int screenRow = GRID_TOP + r, screenCol = 1 + 2 * c;
+					if (screenRow != cursorRow || screenCol != cursorCol) moveTo(screenRow, screenCol);
+					frame += cell;
+					frame += ' ';
+					cursorRow = screenRow;
+					cursorCol = screenCol + 2;
 				}
-				
-				// Update the students location
-				updateLocation(nextX, nextY, knownFX, knownFY);
 			}
-			return false; // Friend is not found
+			moveTo(GRID_TOP + viewRows + 1, 1); // leave the cursor under the grid for any other messages
+
+			std::fwrite(frame.data(), 1, frame.size(), stdout);
+			std::fflush(stdout);
+			return true;
+		}
+
+	private:
+		double minFrameGap;           // seconds between frames at the most
+		std::chrono::steady_clock::time_point lastFrame;
+		std::string frame;            // the escape codes and characters of the frame being built
+		std::vector<char> shown;      // what every space on the screen shows right now
+		std::string shownStatus;      // what the status line shows right now
+		int shownRows = 0, shownCols = 0;
+		bool valid = false;           // false if the screen can't be trusted to match shown
+
+		// Adds the escape code that puts the cursor at (row, col), both counting from 1
+		void moveTo(int row, int col) {
+			char code[32];
+			int length = std::snprintf(code, sizeof(code), "\x1b[%d;%dH", row, col);
+			frame.append(code, length);
 		}
 };
 
+// ==========================================
+//                 EPISODES
+// ==========================================
+// One generation in one world: the world itself, its students, the scratch memory for stepping
+// them and how the generation is going. main() keeps one per world and reuses them every round.
+struct Episode {
+	World world;
+	StudentPopulation students;
+	StepContext ctx;
+	bool friendFound = false;      // if anyone has found the friend yet
+	int knownFX = 0, knownFY = 0;  // where the students think the friend is
+	int steps = 0;                 // steps taken so far
+	int findStep = -1;             // step the friend was found on (-1 = not yet)
+	int finder = -1;               // the student who found the friend (-1 = not yet)
+	int foundX = 0, foundY = 0;    // the space they were standing on when they did
+	bool gathered = false;         // true once every student is at the gathering place
+};
+
+// ==========================================
+//             RUN CONFIGURATION
+// ==========================================
+
+// Settings for a single run of the program, filled in from the command line
+struct SimConfig {
+	bool headless = false;   // run without rendering, sleeping or asking to retry
+	int generations = 1000;  // how many generations to simulate in headless mode
+	int maxSteps = 60;       // safety break for each generation
+	int numStudents = 5;     // number of students to roam around the maze
+	int rows = DEFAULT_GRID_SIZE; // height of the grid
+	int cols = DEFAULT_GRID_SIZE; // width of the grid
+	unsigned int seed = 0;   // seed for every random number of the run (see CounterRng)
+	int batchSize = 1;       // samples per weight update in the training phase (1 = per-sample SGD)
+	int threads = 0;         // worker threads for stepping the students (0 = one per CPU core)
+	int worlds = 1;          // worlds simulated side by side in every round (headless only)
+	int fps = 30;            // most frames drawn per second in interactive mode (0 = no limit)
+	int stepDelayMs = 400;   // pause after every step in interactive mode
+	int epochs = 1;          // passes over the successful paths in the training phase
+	std::string kernels = "auto"; // which SIMD kernels the neural network uses
+	std::string loadModel;   // model file to start from instead of random weights
+	std::string saveModel;   // model file to write the trained brain to when the run ends
+	std::string experienceLog; // experience log to append every successful path to (empty = none)
+	std::string trainFrom;   // experience log to train the brain on instead of simulating
+	bool train = true;       // if false, the brain is never changed (keeps a loaded model's pages shared)
+	bool frontier = true;    // if false, students explore with only the greedy visit counts
+	bool verifyKernels = false;   // compare the kernels against the scalar reference, then exit
+	bool verifyStatic = false;    // compare the compile-time sized network against the dynamic one, then exit
+	bool staticNetwork = false;   // predict with the compile-time sized network while simulating
+	Precision precision = PRECISION_DOUBLE; // numbers the network predicts with while simulating
+	bool verifyPrecision = false; // report how often float and int8 predictions disagree with double, then exit
+	bool seedGiven = false;  // if false, the seed is taken from the current time
+	bool profileReport = false; // print every generation's profile (needs a -DCAI_PROFILE build)
+	std::string tracePath;   // where to save a Chrome trace of the run (needs a -DCAI_PROFILE build)
+};
+
+// Keeps track of how the generations went, used for the headless summary
+struct RunStats {
+	int generations = 0;         // generations that were simulated
+	int successes = 0;           // generations where all the students gathered
+	long long gatherSteps = 0;   // total steps taken by the successful generations
+	int findings = 0;            // generations where the friend was found
+	long long findSteps = 0;     // total steps it took to find the friend in those generations
+	double trainingMs = 0.0;     // total time spent inside the training phase
+	double slowestTrainingMs = 0.0; // longest single training phase
+	long long steps = 0;         // simulation steps taken over all generations
+	long long stepAllocations = 0; // heap allocations made while stepping (should stay at 0)
+	unsigned long long stateHash = 0; // mix of every student's final position, to compare runs with different thread counts
+	long long predictions = 0;        // neural network predictions made while stepping
+	long long predictionsSkipped = 0; // student moves that were decided without the network
+	long long cacheHits = 0;          // predictions answered by the policy cache
+	double precisionMismatchRate = 0.0; // how often the final brain picks another direction at the chosen precision
+	long long experienceLogged = 0;     // path steps appended to the experience log
+};
+
 // defining functions for the main() program
-void showGrid(); // displays the current grid layout
-bool checkGathered(Student students[], int numStudents); // checks if all the students are gathered at one place
-void simulationStep(Student students[], int numStudents, bool &friendFound, int &knownFX, int &knownFY); // the movement of the student
+bool checkGathered(const StudentPopulation &students); // checks if all the students are gathered at one place
+void beginEpisode(Episode &episode, int numStudents, unsigned long long seed, long long generation); // starts a new generation in the episode's world
+void stepEpisode(Episode &episode); // moves the episode's students one step
+void runEpisode(Episode &episode, int maxSteps); // steps the episode until everyone gathered or maxSteps is hit
+bool findSpace(const Grid &grid, CounterRng &rng, int &x, int &y); // picks a random empty space on the grid
+void spawnGeneration(World &world, StudentPopulation &students, int numStudents, unsigned long long seed, long long generation); // sets up the grid, friend and students for a new generation
+bool simulationStep(StudentPopulation &students, bool &friendFound, int &knownFX, int &knownFY, StepContext &ctx); // the movement of the student
+bool parseArgs(int argc, char* argv[], SimConfig &config); // reads the command-line options into config
+void printUsage(const char* program); // displays the available command-line options
+void printSummary(const SimConfig &config, const RunStats &stats); // displays the machine-readable headless summary
+bool trainFromLog(const std::string &path, NeuralNetwork &network, int batchSize, int epochs, ThreadPool &pool, long long &samples); // trains on a saved experience log
+#ifdef CAI_BENCHMARK
+int runBenchmarks(int argc, char* argv[]); // the benchmark build's main(), prints the timings as JSON
+#endif
 
 
-int main()
+int main(int argc, char* argv[])
 {
-	// title card sequence
-    cout << "**********************************************\n";
-    cout << "     COLLECTIVE AI : STUDY SESSION FINDER     \n";
-    cout << "**********************************************\n\n";
-    
+#ifdef CAI_BENCHMARK
+	return runBenchmarks(argc, argv); // the benchmark build only measures, it doesn't run the simulation
+#endif
+
+	// read the command-line options first, in case we are running headless
+	SimConfig config;
+	if (!parseArgs(argc, argv, config))
+	{
+		printUsage(argv[0]);
+		return 1;
+	}
+
+	// pick the neural network kernels for this CPU
+	if (!selectKernels(config.kernels))
+	{
+		cout << "Kernels '" << config.kernels << "' are not supported on this CPU.\n";
+		return 1;
+	}
+
+	if (config.verifyKernels)
+	{
+		// check the vectorized kernels against the scalar ones (the fast sigmoid is an approximation)
+		const double TOLERANCE = 1e-9;
+		double worst = verifyKernels();
+		cout << "kernels " << kernels->name << ": max difference from scalar " << worst
+			<< (worst <= TOLERANCE ? " (ok)\n" : " (FAILED)\n");
+		// floats only carry about 7 digits, so their sums are allowed to drift more
+		const double REDUCED_TOLERANCE = 1e-5;
+		double reducedWorst = verifyReducedKernels();
+		cout << "kernels " << kernels->name << " (float/int8): max difference from scalar " << reducedWorst
+			<< (reducedWorst <= REDUCED_TOLERANCE ? " (ok)\n" : " (FAILED)\n");
+		return (worst <= TOLERANCE && reducedWorst <= REDUCED_TOLERANCE) ? 0 : 1;
+	}
+
+	if (config.verifyStatic)
+	{
+		// the compile-time sized networks should predict and train exactly like the dynamic one
+		const double TOLERANCE = 1e-9;
+		double worst = std::max(verifyStaticNetwork<4, 8, 4>(), verifyStaticNetwork<4, 64, 64, 4>());
+		cout << "static network: max difference from dynamic " << worst
+			<< (worst <= TOLERANCE ? " (ok)\n" : " (FAILED)\n");
+		return worst <= TOLERANCE ? 0 : 1;
+	}
+
+	if (config.profileReport || !config.tracePath.empty())
+	{
+#ifdef CAI_PROFILE
+		if (!config.tracePath.empty()) profiler.enableTrace();
+#else
+		std::cerr << "Profiling options need a build with -DCAI_PROFILE, ignoring them.\n";
+#endif
+	}
+
 	// defining variables to be used within the main() function
-    srand(time(0)); // randomizing seed for this session
+    if (!config.seedGiven) config.seed = (unsigned int)time(0); // randomizing seed for this session
     bool retry = true; // indicates if the player wants to retry the maze
     char userInput; // gets user input
-    const int NUM_STUDENTS = 5; // number of students to roam around the maze
+    const int NUM_STUDENTS = config.numStudents; // number of students to roam around the maze
+    RunStats stats; // used for the summary at the end of a headless run
     
 	// Setup Variables: Layers
     int topology[] = {4, 8, 4}; // 4 Inputs (X, Y, TargetX, TargetY) -> 1 Hidden Layer (8 Neurons) -> 4 Outputs (Up, Down, Left, Right)
-    sharedBrain = new NeuralNetwork(topology, 3);
+    if (!config.loadModel.empty())
+    {
+        // start warm from a model that was trained before
+        sharedBrain = NeuralNetwork::load(config.loadModel);
+        if (!sharedBrain || sharedBrain->layers[0].num_inputs != 4 || sharedBrain->outputSize() != 4)
+        {
+            cout << "Could not load a 4 input, 4 output model from '" << config.loadModel << "'.\n";
+            delete sharedBrain;
+            return 1;
+        }
+    }
+    else
+    {
+        sharedBrain = new NeuralNetwork(topology, 3, config.seed);
+    }
+    
+    if (config.verifyPrecision)
+    {
+        // how often the smaller numbers change the network's favourite direction (use --load-model to check a trained brain)
+        for (Precision precision : {PRECISION_FLOAT, PRECISION_INT8})
+        {
+            ReducedNetwork reduced;
+            reduced.copyFrom(*sharedBrain, precision);
+            cout << PRECISION_NAMES[precision] << ": " << reduced.weightBytes() << " weight bytes, picks another direction than double "
+                << precisionMismatchRate(*sharedBrain, precision, config.rows, config.cols) * 100.0 << "% of the time\n";
+        }
+        delete sharedBrain;
+        return 0;
+    }
+
+	// Setup Variables: Threads
+    if (config.threads == 0) config.threads = (int)std::thread::hardware_concurrency();
+    if (config.threads < 1) config.threads = 1;
+    ThreadPool pool(config.threads);
+    ThreadPool inlinePool(1); // when worlds run side by side, each one steps its students on the thread it runs on
+    
+    if (!config.trainFrom.empty())
+    {
+        // offline training: stream the saved paths through the brain instead of simulating anything
+        long long samples = 0;
+        auto trainingStart = std::chrono::steady_clock::now();
+        bool trained = trainFromLog(config.trainFrom, *sharedBrain, config.batchSize, config.epochs, pool, samples);
+        double trainingMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - trainingStart).count();
+        if (!trained) cout << "Could not read the experience log '" << config.trainFrom << "'.\n";
+        else cout << "Trained on " << samples << " samples from '" << config.trainFrom << "' in " << trainingMs << " ms.\n";
+        if (trained && !config.saveModel.empty() && !sharedBrain->save(config.saveModel))
+        {
+            cout << "Could not save the model to '" << config.saveModel << "'.\n";
+            trained = false;
+        }
+        delete sharedBrain;
+        return trained ? 0 : 1;
+    }
+
+    ExperienceLog* experienceLog = nullptr; // where the successful paths go, if anywhere
+    if (!config.experienceLog.empty())
+    {
+        experienceLog = ExperienceLog::open(config.experienceLog);
+        if (!experienceLog)
+        {
+            cout << "Could not open the experience log '" << config.experienceLog << "'.\n";
+            delete sharedBrain;
+            return 1;
+        }
+    }
+
+	// Setup Variables: Worlds
+    // With one world the threads share out the students of every step. With more, every thread
+    // takes whole worlds instead, and all of them read the same brain (it only learns between rounds).
+    const int NUM_WORLDS = config.worlds;
+    std::vector<Episode> episodes(NUM_WORLDS); // one per world, reused every round
+    for (Episode &episode : episodes)
+    {
+        episode.world.grid.resize(config.rows, config.cols);
+        episode.students.useFrontier = config.frontier;
+        episode.ctx.useFastBrain = config.staticNetwork;
+        episode.ctx.precision = config.precision;
+        if (config.staticNetwork && !episode.ctx.fastBrain.copyFrom(*sharedBrain))
+        {
+            cout << "--static-network only works with a 4-8-4 brain.\n";
+            delete sharedBrain;
+            return 1;
+        }
+
+        // When the first student finds the friend, remember who it was, where, and how long it took
+        Episode* self = &episode;
+        episode.ctx.onFriendFound = [self](int student, int friendX, int friendY) {
+            self->findStep = self->steps;
+            self->finder = student;
+            self->foundX = friendX;
+            self->foundY = friendY;
+        };
+        episode.ctx.setup(NUM_WORLDS == 1 ? &pool : &inlinePool, NUM_STUDENTS, episode.world);
+    }
+    NeuralNetwork::TrainingWorkspace trainingScratch = sharedBrain->makeTrainingWorkspace(config.batchSize, pool.size()); // reused for every training phase
+    std::vector<double> trainingInputs;   // the successful path steps of a round, one sample per row
+    std::vector<double> trainingExpected; // the direction each of those steps took
+    TerminalRenderer renderer(config.fps); // draws the grid in interactive mode
     
+	if (!config.headless)
+	{
+		// title card sequence (only once we know the interactive loop is going to run)
+		cout << "**********************************************\n";
+		cout << "     COLLECTIVE AI : STUDY SESSION FINDER     \n";
+		cout << "**********************************************\n\n";
+	}
+
 	// Used to keep track of each reset count
     int generation = 0;
 
     do{
-        generation++; // +1 to the reset count
+        // every world plays one generation per round (the last headless round might not need all of them)
+        int numRunning = NUM_WORLDS;
+        if (config.headless && config.generations - generation < numRunning) numRunning = config.generations - generation;
         
-		// Fill up the grid with empty spaces initially
-        for(int i = 0; i < GRID_SIZE; i++) {
-            for(int j = 0; j < GRID_SIZE; j++) {
-                grid[i][j] = SPACE;
-                visited_count[i][j] = 0; 
+        // --- Simulation Loop ---
+        if (NUM_WORLDS == 1)
+        {
+            Episode &episode = episodes[0];
+            {
+                // Build a new maze with a new friend and new students
+                PROFILE_SCOPE(PHASE_GENERATE);
+                beginEpisode(episode, NUM_STUDENTS, config.seed, generation);
             }
-        }
-        
-        // Spawn Walls 
-        for(int i = 0; i < (rand() % 10) + 10; i++) {
-            int rX = rand() % GRID_SIZE; // randomly set the x position for wall
-            int rY = rand() % GRID_SIZE; // randomly set the y position for wall
-            grid[rX][rY] = WALL; // set the wall inside the grid
-        }
-        
-        // Spawn Friend 
-        do{
-            actualFriendX = rand() % GRID_SIZE; // randomly set the x position for friend
-            actualFriendY = rand() % GRID_SIZE; // randomly set the y position for friend
-        }while(grid[actualFriendX][actualFriendY] != SPACE);
-        
-		// Set the variables for all the friend information
-        grid[actualFriendX][actualFriendY] = FRIEND;
-        int knownFriendX = actualFriendX; 
-        int knownFriendY = actualFriendY; 
-    
-        // Spawn Students 
-        Student students[NUM_STUDENTS] = {};
-        
-        for(int i = 0; i < NUM_STUDENTS; i++) {
-            int x, y;
-			
-			// Find a space where the students can spawn
-            do{
-                x = rand() % GRID_SIZE; // randomly set the x position for student
-                y = rand() % GRID_SIZE; // randomly set the y position for student
-            }while(grid[x][y] != SPACE);
+            renderer.invalidate(); // the last generation's messages are still on the screen
+            while(!episode.gathered && episode.steps < config.maxSteps) { // Safety break at maxSteps
+                long long allocationsBefore = heapAllocations.load(std::memory_order_relaxed);
+                {
+                    PROFILE_SCOPE(PHASE_STEP);
+                    stepEpisode(episode);
+                }
+                long long stepAllocations = heapAllocations.load(std::memory_order_relaxed) - allocationsBefore;
+                stats.stepAllocations += stepAllocations;
+                PROFILE_COUNT(COUNTER_STEP_ALLOCATIONS, stepAllocations);
+                stats.steps++;
                 
-			// Set the students location
-            students[i].updateLocation(x,y, knownFriendX, knownFriendY);
+                if (!config.headless)
+                {
+                    {
+                        PROFILE_SCOPE(PHASE_RENDER);
+                        // displays generation and step count, and the grid layout (only the spaces that changed)
+                        std::string status = "Gen " + std::to_string(generation + 1) + " | Step " + std::to_string(episode.steps);
+                        if (episode.findStep >= 0) status += " | FRIEND FOUND by student " + std::to_string(episode.finder + 1) + " at ("
+                            + std::to_string(episode.foundX) + "," + std::to_string(episode.foundY) + ")! Converging...";
+                        bool last = episode.gathered || episode.steps >= config.maxSteps;
+                        renderer.draw(episode.world.grid, status, last);
+                    }
+                    std::this_thread::sleep_for(std::chrono::milliseconds(config.stepDelayMs)); // wait before the next step
+                }
+            }
         }
-        
-        bool friendFound = false;
-        int stepCount = 0;
-        
-        // --- Simulation Loop ---
-        while(!checkGathered(students, NUM_STUDENTS) && stepCount < 60) { // Safety break at 60 steps
-            cout << "Gen " << generation << " | Step " << ++stepCount << "\n"; // displays generation and step count
-            simulationStep(students, NUM_STUDENTS, friendFound, knownFriendX, knownFriendY);
-            showGrid(); // display grid layout now
-            std::this_thread::sleep_for(std::chrono::milliseconds(400)); // wait 400 miliseconds
+        else
+        {
+            // every world builds its maze on whichever thread picks it up (the random numbers are keyed
+            // by the generation, so it doesn't matter which thread that is), then the same for the steps
+            auto spawnWorlds = [&](int begin, int end, int /*worker*/) {
+                for (int w = begin; w < end; ++w) beginEpisode(episodes[w], NUM_STUDENTS, config.seed, generation + w);
+            };
+            {
+                PROFILE_SCOPE(PHASE_GENERATE);
+                pool.parallelForEach(numRunning, spawnWorlds);
+            }
+
+            long long allocationsBefore = heapAllocations.load(std::memory_order_relaxed);
+            auto runWorlds = [&](int begin, int end, int /*worker*/) {
+                for (int w = begin; w < end; ++w) runEpisode(episodes[w], config.maxSteps);
+            };
+            {
+                PROFILE_SCOPE(PHASE_WORLDS);
+                pool.parallelForEach(numRunning, runWorlds);
+            }
+            long long stepAllocations = heapAllocations.load(std::memory_order_relaxed) - allocationsBefore;
+            stats.stepAllocations += stepAllocations;
+            PROFILE_COUNT(COUNTER_STEP_ALLOCATIONS, stepAllocations);
+            for (int w = 0; w < numRunning; ++w) stats.steps += episodes[w].steps;
         }
         
-        if (checkGathered(students, NUM_STUDENTS)) 
-		{
-			// Display a success message!
-            cout << "\nSUCCESS! Students gathered at (" << actualFriendX << "," << actualFriendY << ").\n";
-        } 
-		else 
-		{
-			// Display a failed message
-             cout << "\nTIMEOUT. Resetting...\n";
+        // go through the worlds in order, so the results don't depend on which thread finished first
+        for (int w = 0; w < numRunning; ++w)
+        {
+            const Episode &episode = episodes[w];
+            generation++; // +1 to the reset count
+            for (int i = 0; i < NUM_STUDENTS; i++)
+            {
+                stats.stateHash = stats.stateHash * 1099511628211ULL + ((unsigned long long)episode.students.posX[i] << 32 | (unsigned)episode.students.posY[i]);
+            }
+            stats.generations++;
+            if (episode.gathered)
+            {
+                stats.successes++;
+                stats.gatherSteps += episode.steps;
+            }
+            if (episode.findStep >= 0)
+            {
+                stats.findings++;
+                stats.findSteps += episode.findStep;
+            }
+
+            if (!config.headless)
+            {
+                if (episode.gathered) 
+                {
+                    // Display a success message!
+                    cout << "\nSUCCESS! Students gathered at (" << episode.world.friendX << "," << episode.world.friendY << ").\n";
+                } 
+                else 
+                {
+                    // Display a failed message
+                    cout << "\nTIMEOUT. Resetting...\n";
+                }
+            }
         }
 
         // --- TRAINING PHASE ---
-        // Teach the brain based on the student who actually found the friend.
+        // Teach the brain based on the students who actually found the friend (in every world).
         // We assume the greedy path that WORKED is a path worth learning.
 		
-        cout << "Training Neural Network on successful paths...\n";
+        if (!config.headless && config.train) cout << "Training Neural Network on successful paths...\n";
+        auto trainingStart = std::chrono::steady_clock::now();
 		
 		// Iterate and check through each student to see if they found the friend
-        for(int i=0; i < NUM_STUDENTS; i++) 
-		{
-            if(students[i].knowsFriend) 
-			{
-				// Train it based on each of the students' step in their path history.
-                for(auto& step : students[i].pathHistory) 
-				{
-                    double expected[4] = {0,0,0,0};
-                    expected[step.bestDir] = 1.0; // The direction that led to success is correct
-                    sharedBrain->train(step.inputs, expected, 4);
+        trainingInputs.clear();
+        trainingExpected.clear();
+        for (int w = 0; w < numRunning; ++w)
+        {
+            const StudentPopulation &students = episodes[w].students;
+            for(int i=0; i < NUM_STUDENTS; i++) 
+            {
+                if(students.knowsFriend[i]) 
+                {
+                    // Collect each of the students' step in their path history as one row of the batch
+                    // (and keep it in the experience log, which writes it out in the background).
+                    if (experienceLog) experienceLog->beginPath(config.rows, config.cols);
+                    students.forEachStep(i, [&](const HistoryStep &step)
+                    {
+                        double expected[4] = {0,0,0,0};
+                        expected[step.bestDir] = 1.0; // The direction that led to success is correct
+                        trainingInputs.insert(trainingInputs.end(), step.inputs, step.inputs + 4);
+                        trainingExpected.insert(trainingExpected.end(), expected, expected + 4);
+                        if (experienceLog) experienceLog->addStep(step);
+                    });
+                    if (experienceLog) experienceLog->endPath();
                 }
             }
         }
+        if (experienceLog) experienceLog->flush(); // the round's paths go to disk now, not when a chunk fills up
+
+        // Train on all of them together in mini-batches
+        int numSamples = config.train ? (int)(trainingInputs.size() / 4) : 0;
+        sharedBrain->trainBatch(trainingInputs.data(), trainingExpected.data(), numSamples, config.batchSize, config.epochs, trainingScratch, pool);
+
+        // record how long the training phase took
+        auto trainingEnd = std::chrono::steady_clock::now();
+        double trainingMs = std::chrono::duration<double, std::milli>(trainingEnd - trainingStart).count();
+        PROFILE_RECORD(PHASE_TRAIN, trainingStart, trainingEnd);
+        PROFILE_END_GENERATION(generation - numRunning + 1, numRunning, config.profileReport ? &std::cerr : nullptr);
+        stats.trainingMs += trainingMs;
+        if (trainingMs > stats.slowestTrainingMs) stats.slowestTrainingMs = trainingMs;
         
-		// Ask the user if they would like to retry the maze?
-        cout << "Retry? (Y/N): ";
-        cin >> userInput;
-        retry = (userInput == 'Y' || userInput == 'y');
+        if (config.headless)
+        {
+            // no one is at the keyboard, keep going until we've hit the generation count
+            retry = generation < config.generations;
+        }
+        else
+        {
+            // Ask the user if they would like to retry the maze?
+            cout << "Retry? (Y/N): ";
+            cin >> userInput;
+            retry = (userInput == 'Y' || userInput == 'y');
+        }
 
     }while(retry);
     
+    for (const Episode &episode : episodes)
+    {
+        stats.predictions += episode.ctx.predictions;
+        stats.predictionsSkipped += episode.ctx.predictionsSkipped;
+        stats.cacheHits += episode.ctx.cache.hits;
+    }
+    stats.precisionMismatchRate = precisionMismatchRate(*sharedBrain, config.precision, config.rows, config.cols);
+    if (experienceLog)
+    {
+        stats.experienceLogged = experienceLog->samples;
+        if (!experienceLog->close()) cout << "Could not write everything to the experience log '" << config.experienceLog << "'.\n";
+        delete experienceLog;
+    }
+    if (config.headless) printSummary(config, stats);
+#ifdef CAI_PROFILE
+    profiler.printReport(std::cerr); // kept off stdout so the headless summary is still the only thing there
+    if (!config.tracePath.empty() && !profiler.writeTrace(config.tracePath))
+    {
+        cout << "Could not write the trace to '" << config.tracePath << "'.\n";
+    }
+#endif
+
+    if (!config.saveModel.empty() && !sharedBrain->save(config.saveModel))
+    {
+        cout << "Could not save the model to '" << config.saveModel << "'.\n";
+    }
+
     delete sharedBrain;
     return 0;
 }
@@ -550,54 +4083,691 @@ int main()
 // *************************
 
 
-// Display the grid layout: shows all the walls, users, friends, and empty spaces
-void showGrid()
+// Starts a new generation in the episode's world: a fresh maze, friend and students, and nothing found yet
+void beginEpisode(Episode &episode, int numStudents, unsigned long long seed, long long generation)
 {
-	// Iterate through each grid, displaying the location
-    for(int i = 0; i < GRID_SIZE; i++) {
-        for(int j = 0; j < GRID_SIZE; j++) cout << grid[i][j] << ' ';
-        cout << '\n';
-    }
-    cout << "\n";
+    spawnGeneration(episode.world, episode.students, numStudents, seed, generation);
+    episode.friendFound = false;
+    episode.knownFX = episode.world.friendX; // where the students will gather once someone finds the friend
+    episode.knownFY = episode.world.friendY;
+    episode.steps = 0;
+    episode.findStep = -1;
+    episode.finder = -1;
+    episode.gathered = checkGathered(episode.students);
+}
+
+// Moves the episode's students one step (the friend-found hook in episode.ctx sees episode.steps already counted)
+void stepEpisode(Episode &episode)
+{
+    episode.steps++;
+    simulationStep(episode.students, episode.friendFound, episode.knownFX, episode.knownFY, episode.ctx);
+    episode.gathered = checkGathered(episode.students);
+}
+
+// Steps the episode until everyone is gathered or it runs out of steps. Used to run many worlds at once,
+// so it only touches the episode itself (and reads the shared brain, which doesn't change until training).
+void runEpisode(Episode &episode, int maxSteps)
+{
+    while (!episode.gathered && episode.steps < maxSteps) stepEpisode(episode);
 }
 
-void simulationStep(Student students[], int numStudents, bool &friendFound, int &knownFX, int &knownFY) 
+// Moves every student once. Returns true on the step where the friend is first found.
+// The step is double-buffered: first every student decides where to go by reading the grid as it was
+// at the start of the step (split across the thread pool), then the moves are applied in student order.
+// If two students want the same space, the one with the lower index gets it and the other one waits
+// (the gathering place is the exception, everyone is allowed in there). This gives the same result
+// for a given seed no matter how many threads are used.
+bool simulationStep(StudentPopulation &students, bool &friendFound, int &knownFX, int &knownFY, StepContext &ctx) 
 {
+    int numStudents = students.size();
+    World &world = *students.world;
+    Grid &grid = world.grid;
+    students.reserveStep(); // room for everyone to record a step, so the workers never have to grow the arena
+
+    // --- PLAN: everything that doesn't need the neural network (nothing shared is written here) ---
+    bool found = friendFound;
+    if (found)
+    {
+        PROFILE_SCOPE(PHASE_DISTANCE_FIELD);
+        world.friendDistance.ensure(grid, knownFX, knownFY, world.searchQueue); // only does the search when the walls or the friend moved
+    }
+    ctx.cache.sync(sharedBrain->version); // forget the cached predictions if the brain has learned since
+    if (ctx.useFastBrain && ctx.fastBrain.version != sharedBrain->version) ctx.fastBrain.copyFrom(*sharedBrain);
+    if (ctx.precision != PRECISION_DOUBLE && ctx.reducedBrain.version != sharedBrain->version) ctx.reducedBrain.copyFrom(*sharedBrain, ctx.precision);
+    auto plan = [&](int begin, int end, int /*worker*/) {
+        for (int i = begin; i < end; ++i)
+        {
+            MovePlan &p = ctx.plans[i];
+            students.planMove(i, found, knownFX, knownFY, p);
+            p.cached = p.needsPrediction ? ctx.cache.find(students.posX[i], students.posY[i], knownFX, knownFY) : nullptr;
+        }
+    };
+    {
+        PROFILE_SCOPE(PHASE_PLAN);
+        ctx.pool->parallelFor(numStudents, 64, plan);
+    }
+
+    // Only the students stuck on a tie between greedy moves need a prediction,
+    // and only the ones the cache couldn't answer have to ask the network
+    int numRows = 0;
+    int numNeeded = 0;
+    for (int i = 0; i < numStudents; ++i)
+    {
+        MovePlan &p = ctx.plans[i];
+        if (!p.needsPrediction) continue;
+        numNeeded++;
+        if (!p.cached)
+        {
+            p.predictionRow = numRows;
+            ctx.predictFor[numRows++] = i;
+        }
+    }
+    ctx.predictions += numRows;
+    ctx.predictionsSkipped += numStudents - numNeeded;
+    ctx.cache.hits += numNeeded - numRows;
+    ctx.cache.misses += numRows;
+    PROFILE_COUNT(COUNTER_PREDICTIONS, numRows);
+    PROFILE_COUNT(COUNTER_CACHE_HITS, numNeeded - numRows);
+
+    // --- PREDICT: gather those students' inputs into one matrix and run it through the network in blocks ---
+    int numOutputs = sharedBrain->outputSize();
+    auto predict = [&](int begin, int end, int worker) {
+        NeuralNetwork::BatchWorkspace &ws = ctx.workspaces[worker];
+        for (int block = begin; block < end; block += StepContext::INFERENCE_BLOCK)
+        {
+            int rows = (end - block < StepContext::INFERENCE_BLOCK) ? end - block : StepContext::INFERENCE_BLOCK;
+            double* blockInputs = ctx.inputs.data() + (size_t)block * 4;
+            for (int r = 0; r < rows; ++r)
+            {
+                students.fillInputs(ctx.predictFor[block + r], blockInputs + (size_t)r * 4, knownFX, knownFY);
+            }
+            
+            if (ctx.useFastBrain)
+            {
+                // the compile-time sized network goes one row at a time (each one is fully unrolled)
+                FastBrain::Workspace &fws = ctx.fastWorkspaces[worker];
+                for (int r = 0; r < rows; ++r)
+                {
+                    const double* outputs = ctx.fastBrain.predict(blockInputs + (size_t)r * 4, fws);
+                    std::copy(outputs, outputs + numOutputs, ctx.prefs.data() + (size_t)(block + r) * numOutputs);
+                }
+                continue;
+            }
+            if (ctx.precision != PRECISION_DOUBLE)
+            {
+                // the float / int8 copy takes the whole block at once too
+                const double* outputs = ctx.reducedBrain.predictBatch(blockInputs, rows, ctx.reducedWorkspaces[worker]);
+                std::copy(outputs, outputs + (size_t)rows * numOutputs, ctx.prefs.data() + (size_t)block * numOutputs);
+                continue;
+            }
+
+            // hand each student their row of the output matrix
+            const double* outputs = sharedBrain->predictBatch(blockInputs, rows, ws);
+            std::copy(outputs, outputs + (size_t)rows * numOutputs, ctx.prefs.data() + (size_t)block * numOutputs);
+        }
+    };
+    {
+        PROFILE_SCOPE(PHASE_PREDICT);
+        ctx.pool->parallelFor(numRows, 64, predict);
+    }
+
+    // --- DECIDE: break the ties and record the history (each student only touches their own things) ---
+    auto decide = [&](int begin, int end, int /*worker*/) {
+        for (int i = begin; i < end; ++i)
+        {
+            const MovePlan &p = ctx.plans[i];
+            const double* nnPrefs = nullptr;
+            if (p.needsPrediction) nnPrefs = p.cached ? p.cached : ctx.prefs.data() + (size_t)p.predictionRow * numOutputs;
+            ctx.intents[i] = students.finishMove(i, found, knownFX, knownFY, p, nnPrefs);
+        }
+    };
+    {
+        PROFILE_SCOPE(PHASE_DECIDE);
+        ctx.pool->parallelFor(numStudents, 64, decide);
+    }
+
+    // remember the new predictions for next time (done after deciding, so no cached row moves while it's in use)
+    for (int r = 0; r < numRows; ++r)
+    {
+        int i = ctx.predictFor[r];
+        ctx.cache.insert(students.posX[i], students.posY[i], knownFX, knownFY, ctx.prefs.data() + (size_t)r * numOutputs);
+    }
+
+    // --- COMMIT: sort out who gets which space, then move everyone ---
+    PROFILE_SCOPE(PHASE_COMMIT);
     bool newlyFound = false;
+    ctx.claims.nextStep();
     for (int i = 0; i < numStudents; ++i) 
 	{
-		// Check if the friend has been found for the first time
-        if (!friendFound) 
-		{
-            if (students[i].tryMove(friendFound, knownFX, knownFY))
-			{
-				newlyFound = true;
-			} 
-        } 
-		else 
-		{
-			// Move normally
-			students[i].tryMove(friendFound, knownFX, knownFY);
+        MoveIntent &intent = ctx.intents[i];
+        bool moving = (intent.x != students.posX[i] || intent.y != students.posY[i]);
+        if (!moving) continue;
+
+        bool gatherPlace = (intent.x == world.friendX && intent.y == world.friendY);
+        if (!gatherPlace && !ctx.claims.claim(grid.index(intent.x, intent.y)))
+        {
+            // a student before this one already took the space, so stay put this step
+            intent.x = students.posX[i];
+            intent.y = students.posY[i];
+            continue;
         }
+        students.leaveCell(i); // clear everyone's old space first so no one wipes out a student who just arrived
     }
-	
-    if (newlyFound) 
+
+    for (int i = 0; i < numStudents; ++i) 
 	{
-		// If friend has just been found, display the message
-        friendFound = true;
-        cout << "FRIEND FOUND! Converging...\n";
+        const MoveIntent &intent = ctx.intents[i];
+        if (intent.x == students.posX[i] && intent.y == students.posY[i]) continue;
+
+		// Check if the friend has been found for the first time
+        if (intent.findsFriend)
+        {
+            students.knowsFriend[i] = 1;
+            if (!friendFound)
+            {
+                // let everyone know straight away (every student already decided this step, so they'll see it next step)
+                friendFound = true;
+                newlyFound = true;
+                if (ctx.onFriendFound) ctx.onFriendFound(i, intent.x, intent.y);
+            }
+        }
+        students.enterCell(i, intent.x, intent.y);
     }
+	
+    return newlyFound;
 }
 
-bool checkGathered(Student students[], int numStudents) 
+bool checkGathered(const StudentPopulation &students) 
 {
-	// Iterate through each student and check if they all found the student
-    for (int i = 0; i < numStudents; ++i) 
+	// The population counts the students at the gathering place as they move, so this is just one comparison
+    return students.allGathered();
+}
+
+// Reads the command-line options into config. Returns false if an option is not recognized.
+bool parseArgs(int argc, char* argv[], SimConfig &config)
+{
+	for (int i = 1; i < argc; ++i)
 	{
-        if (!(students[i].x == actualFriendX && students[i].y == actualFriendY))
+		std::string arg = argv[i];
+		bool hasValue = (i + 1 < argc); // most options are followed by a number
+
+		if (arg == "--headless") config.headless = true;
+		else if (arg == "--generations" && hasValue) config.generations = atoi(argv[++i]);
+		else if (arg == "--steps" && hasValue) config.maxSteps = atoi(argv[++i]);
+		else if (arg == "--students" && hasValue) config.numStudents = atoi(argv[++i]);
+		else if (arg == "--size" && hasValue) config.rows = config.cols = atoi(argv[++i]);
+		else if (arg == "--rows" && hasValue) config.rows = atoi(argv[++i]);
+		else if (arg == "--cols" && hasValue) config.cols = atoi(argv[++i]);
+		else if (arg == "--batch-size" && hasValue) config.batchSize = atoi(argv[++i]);
+		else if (arg == "--epochs" && hasValue) config.epochs = atoi(argv[++i]);
+		else if (arg == "--threads" && hasValue) config.threads = atoi(argv[++i]);
+		else if (arg == "--worlds" && hasValue) config.worlds = atoi(argv[++i]);
+		else if (arg == "--fps" && hasValue) config.fps = atoi(argv[++i]);
+		else if (arg == "--step-delay" && hasValue) config.stepDelayMs = atoi(argv[++i]);
+		else if (arg == "--kernels" && hasValue) config.kernels = argv[++i];
+		else if (arg == "--verify-kernels") config.verifyKernels = true;
+		else if (arg == "--verify-static") config.verifyStatic = true;
+		else if (arg == "--static-network") config.staticNetwork = true;
+		else if (arg == "--verify-precision") config.verifyPrecision = true;
+		else if (arg == "--precision" && hasValue)
 		{
-			return false;
+			std::string name = argv[++i];
+			if (name == "double") config.precision = PRECISION_DOUBLE;
+			else if (name == "float") config.precision = PRECISION_FLOAT;
+			else if (name == "int8") config.precision = PRECISION_INT8;
+			else return false;
+		}
+		else if (arg == "--load-model" && hasValue) config.loadModel = argv[++i];
+		else if (arg == "--save-model" && hasValue) config.saveModel = argv[++i];
+		else if (arg == "--log-experience" && hasValue) config.experienceLog = argv[++i];
+		else if (arg == "--train-from" && hasValue) config.trainFrom = argv[++i];
+		else if (arg == "--no-train") config.train = false;
+		else if (arg == "--no-frontier") config.frontier = false;
+		else if (arg == "--profile-report") config.profileReport = true;
+		else if (arg == "--trace" && hasValue) config.tracePath = argv[++i];
+		else if (arg == "--seed" && hasValue)
+		{
+			config.seed = (unsigned int)strtoul(argv[++i], nullptr, 10);
+			config.seedGiven = true;
 		}
+		else return false;
+	}
+
+	// make sure the numbers actually make sense
+	bool valid = config.generations > 0 && config.maxSteps > 0 && config.numStudents > 0 && config.batchSize > 0 && config.epochs > 0 && config.threads >= 0
+		&& config.worlds > 0 && (config.worlds == 1 || config.headless) && config.fps >= 0 && config.stepDelayMs >= 0
+		&& !(config.staticNetwork && config.precision != PRECISION_DOUBLE)
+		&& config.rows > 1 && config.cols > 1 && config.rows <= MAX_GRID_SIZE && config.cols <= MAX_GRID_SIZE;
+	if (!valid) return false;
+
+	// the friend and every student need a space of their own, even when the most walls get put down
+	long long cells = (long long)config.rows * config.cols;
+	long long mostWalls = 19 * cells / 100; // (see spawnGeneration())
+	return config.numStudents <= cells - mostWalls - 1;
+}
+
+// Displays the available command-line options
+void printUsage(const char* program)
+{
+	cout << "Usage: " << program << " [options]\n";
+	cout << "  --headless         run without rendering or prompts, then print a JSON summary\n";
+	cout << "  --generations N    number of generations to run in headless mode (default 1000)\n";
+	cout << "  --steps N          step cap for each generation (default 60)\n";
+	cout << "  --students N       number of students in the maze (default 5)\n";
+	cout << "  --size N           make the grid N x N (default 10)\n";
+	cout << "  --rows N, --cols N set the height and width of the grid separately\n";
+	cout << "  --seed N           seed for the random generator (default: current time)\n";
+	cout << "  --batch-size N     training samples per weight update (default 1)\n";
+	cout << "  --epochs N         training passes over the successful paths (default 1)\n";
+	cout << "  --threads N        worker threads for stepping the students (default: one per core)\n";
+	cout << "  --worlds N         simulate N worlds side by side, one per thread (headless only, default 1)\n";
+	cout << "  --fps N            most frames drawn per second in interactive mode (default 30, 0 = no limit)\n";
+	cout << "  --step-delay MS    pause after every step in interactive mode (default 400)\n";
+	cout << "  --load-model PATH  start from a saved model (memory-mapped) instead of random weights\n";
+	cout << "  --save-model PATH  save the brain to a model file when the run ends\n";
+	cout << "  --log-experience PATH  append every successful path to an experience log\n";
+	cout << "  --train-from PATH  train the brain on an experience log (--batch-size, --epochs) instead of simulating\n";
+	cout << "  --no-train         never change the brain (skips the training phase)\n";
+	cout << "  --no-frontier      explore with only the visit counts, without heading for unexplored tiles\n";
+	cout << "  --kernels NAME     auto, scalar, sse2, avx2 or avx512 (default auto)\n";
+	cout << "  --verify-kernels   check the selected kernels against the scalar reference and exit\n";
+	cout << "  --static-network   predict with the compile-time sized 4-8-4 network\n";
+	cout << "  --verify-static    check the compile-time sized networks against the dynamic one and exit\n";
+	cout << "  --precision NAME   predict with double, float or int8 weights while simulating (default double)\n";
+	cout << "  --verify-precision report how often float and int8 pick another direction than double, and exit\n";
+	cout << "  --profile-report   print where every generation's time went (profiling builds only)\n";
+	cout << "  --trace PATH       save a Chrome trace of the run (profiling builds only)\n";
+}
+
+// Empties the world's grid and spawns the walls, the friend and every student for a new generation.
+// Everything placed here only depends on seed and generation (the generation's number, from 0),
+// so any thread can set up any generation.
+void spawnGeneration(World &world, StudentPopulation &students, int numStudents, unsigned long long seed, long long generation)
+{
+    Grid &grid = world.grid;
+    students.world = &world;
+
+	// Fill up the grid with empty spaces initially
+    grid.clear();
+    
+    // Spawn Walls (10-19 walls for every 100 spaces, so a grid smaller than 10x10 gets fewer)
+    CounterRng wallRng(seed, generation, CounterRng::STREAM_WALLS);
+    long long numWalls = (wallRng.below(10) + 10) * ((long long)grid.rows * grid.cols) / 100;
+    for(long long i = 0; i < numWalls; i++) {
+        int rX = wallRng.below(grid.rows); // randomly set the x position for wall
+        int rY = wallRng.below(grid.cols); // randomly set the y position for wall
+        grid.set(rX, rY, WALL); // set the wall inside the grid
+    }
+    
+    // Spawn Friend 
+    CounterRng friendRng(seed, generation, CounterRng::STREAM_FRIEND);
+    findSpace(grid, friendRng, world.friendX, world.friendY); // randomly set the position for friend
+    
+	// Set the variables for all the friend information
+    grid.set(world.friendX, world.friendY, FRIEND);
+    
+    // Spawn Students 
+    students.reset(numStudents);
+    
+    for(int i = 0; i < numStudents; i++) {
+        int x, y;
+		
+		// Find a space where the students can spawn
+        CounterRng studentRng(seed, generation, CounterRng::STREAM_STUDENTS, i);
+        findSpace(grid, studentRng, x, y); // randomly set the position for student
+            
+		// Set the students location
+        students.spawn(i, x, y);
+    }
+    grid.sealUnreachable(students.posX.data(), students.posY.data(), numStudents, world.searchQueue); // walled off spaces don't need exploring
+}
+
+// Picks a random empty space. After MAX_TRIES misses (a crowded grid) it walks the grid from a random
+// space to the next empty one instead, so it always finishes. Returns false if there's no empty space
+// at all (parseArgs() rejects settings where that could happen).
+bool findSpace(const Grid &grid, CounterRng &rng, int &x, int &y)
+{
+    const int MAX_TRIES = 64;
+    for (int attempt = 0; attempt < MAX_TRIES; ++attempt)
+    {
+        x = rng.below(grid.rows);
+        y = rng.below(grid.cols);
+        if (grid.at(x, y) == SPACE) return true;
     }
-    return true; // returns true if the previous check failed
-}
\ No newline at end of file
+    long long cells = (long long)grid.rows * grid.cols;
+    long long start = (long long)x * grid.cols + y;
+    for (long long k = 0; k < cells; ++k)
+    {
+        long long cell = (start + k) % cells;
+        x = (int)(cell / grid.cols);
+        y = (int)(cell % grid.cols);
+        if (grid.at(x, y) == SPACE) return true;
+    }
+    return false;
+}
+
+// Streams an experience log through network in batches of up to TRAIN_CHUNK samples, epochs times over,
+// so a log far bigger than memory can be trained on. samples is set to the samples in one pass.
+// Returns false if the log can't be opened.
+bool trainFromLog(const std::string &path, NeuralNetwork &network, int batchSize, int epochs, ThreadPool &pool, long long &samples)
+{
+    const int TRAIN_CHUNK = 16384; // samples read from the log at a time (a multiple of any sensible batch size)
+    ExperienceReader* reader = ExperienceReader::open(path);
+    if (!reader) return false;
+    std::vector<double> inputs((size_t)TRAIN_CHUNK * 4), expected((size_t)TRAIN_CHUNK * 4);
+    NeuralNetwork::TrainingWorkspace scratch = network.makeTrainingWorkspace(batchSize, pool.size());
+    for (int epoch = 0; epoch < epochs; ++epoch)
+    {
+        // a pass over the whole file is one epoch, so the file is read again each time instead of kept around
+        reader->rewind();
+        samples = 0;
+        int count;
+        while ((count = reader->read(inputs.data(), expected.data(), TRAIN_CHUNK)) > 0)
+        {
+            network.trainBatch(inputs.data(), expected.data(), count, batchSize, 1, scratch, pool);
+            samples += count;
+        }
+    }
+    delete reader;
+    return true;
+}
+
+// Displays the results of a headless run as a single line of JSON
+void printSummary(const SimConfig &config, const RunStats &stats)
+{
+	double successRate = (stats.generations > 0) ? (double)stats.successes / stats.generations : 0.0;
+	double meanSteps = (stats.successes > 0) ? (double)stats.gatherSteps / stats.successes : 0.0;
+	double meanFindSteps = (stats.findings > 0) ? (double)stats.findSteps / stats.findings : 0.0;
+	double meanTrainingMs = (stats.generations > 0) ? stats.trainingMs / stats.generations : 0.0;
+
+	cout << "{\"seed\":" << config.seed
+		<< ",\"generations\":" << stats.generations
+		<< ",\"students\":" << config.numStudents
+		<< ",\"rows\":" << config.rows
+		<< ",\"cols\":" << config.cols
+		<< ",\"step_cap\":" << config.maxSteps
+		<< ",\"batch_size\":" << config.batchSize
+		<< ",\"epochs\":" << config.epochs
+		<< ",\"threads\":" << config.threads
+		<< ",\"worlds\":" << config.worlds
+		<< ",\"kernels\":\"" << kernels->name << "\""
+		<< ",\"successes\":" << stats.successes
+		<< ",\"success_rate\":" << successRate
+		<< ",\"mean_steps_to_gather\":" << meanSteps
+		<< ",\"mean_steps_to_find_friend\":" << meanFindSteps
+		<< ",\"mean_training_ms_per_generation\":" << meanTrainingMs
+		<< ",\"max_training_ms_per_generation\":" << stats.slowestTrainingMs
+		<< ",\"total_training_ms\":" << stats.trainingMs
+		<< ",\"steps\":" << stats.steps
+		<< ",\"step_heap_allocations\":" << stats.stepAllocations
+		<< ",\"final_state_hash\":" << stats.stateHash
+		<< ",\"predictions\":" << stats.predictions
+		<< ",\"predictions_skipped\":" << stats.predictionsSkipped
+		<< ",\"policy_cache_hits\":" << stats.cacheHits
+		<< ",\"precision\":\"" << PRECISION_NAMES[config.precision] << "\""
+		<< ",\"precision_mismatch_rate\":" << stats.precisionMismatchRate
+		<< ",\"experience_logged\":" << stats.experienceLogged
+		<< "}\n";
+}
+
+
+#ifdef CAI_BENCHMARK
+// ==========================================
+//                BENCHMARKS
+// ==========================================
+// Only built with -DCAI_BENCHMARK (see "bat file.bat"). Times the neural network, the move planning and
+// whole simulation steps over a few network and grid sizes, and prints the results as JSON so runs from
+// different commits can be compared. Every benchmark is timed in samples of several operations, and
+// the latency percentiles are per operation (a single call is often too quick for the clock).
+
+// Results of one benchmark
+struct BenchResult {
+	std::string name;            // what was measured
+	std::string params;          // which topology / grid / student count it was measured with
+	long long operations = 0;    // how many operations were timed in total
+	double seconds = 0.0;        // how long they took in total
+	std::vector<double> latency; // nanoseconds per operation, one per sample
+};
+
+// Times samples calls of fn(), where every call does opsPerSample operations. One extra call warms up first.
+template <class Fn>
+BenchResult measure(const std::string &name, const std::string &params, int samples, int opsPerSample, Fn fn)
+{
+	BenchResult result;
+	result.name = name;
+	result.params = params;
+	result.latency.reserve(samples);
+	fn();
+	for (int s = 0; s < samples; ++s) {
+		auto start = std::chrono::steady_clock::now();
+		fn();
+		double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+		result.latency.push_back(ns / opsPerSample);
+		result.seconds += ns * 1e-9;
+	}
+	result.operations = (long long)samples * opsPerSample;
+	return result;
+}
+
+// The value that fraction q of the (sorted) latencies are below
+double percentile(const std::vector<double> &sorted, double q)
+{
+	if (sorted.empty()) return 0.0;
+	size_t i = (size_t)(q * (sorted.size() - 1) + 0.5);
+	return sorted[i];
+}
+
+// Writes one result as a line of JSON
+void printBenchResult(const BenchResult &result, bool last)
+{
+	std::vector<double> sorted = result.latency;
+	std::sort(sorted.begin(), sorted.end());
+	double opsPerSecond = (result.seconds > 0.0) ? result.operations / result.seconds : 0.0;
+	cout << "    {\"name\":\"" << result.name << "\",\"params\":\"" << result.params << "\""
+		<< ",\"operations\":" << result.operations
+		<< ",\"ops_per_sec\":" << opsPerSecond
+		<< ",\"p50_ns\":" << percentile(sorted, 0.50)
+		<< ",\"p90_ns\":" << percentile(sorted, 0.90)
+		<< ",\"p99_ns\":" << percentile(sorted, 0.99)
+		<< ",\"max_ns\":" << (sorted.empty() ? 0.0 : sorted.back())
+		<< "}" << (last ? "\n" : ",\n");
+}
+
+// Topology written like "4-8-4"
+std::string topologyName(const int* topology, int size)
+{
+	std::string name;
+	for (int i = 0; i < size; ++i) name += (i ? "-" : "") + std::to_string(topology[i]);
+	return name;
+}
+
+// predict and train on a StaticNetwork, with the same samples and operation counts as the dynamic ones
+template <int... Sizes>
+void benchmarkStaticNetwork(std::vector<BenchResult> &results, int samples)
+{
+	int topology[] = {Sizes...};
+	std::string params = topologyName(topology, (int)sizeof...(Sizes)) + "/static";
+	NeuralNetwork dynamic(topology, (int)sizeof...(Sizes));
+	StaticNetwork<Sizes...>* network = new StaticNetwork<Sizes...>(); // can be big, keep it off the stack
+	network->copyFrom(dynamic);
+	typename StaticNetwork<Sizes...>::Workspace ws = network->makeWorkspace();
+	int numOutputs = network->outputSize();
+
+	const int BATCH = 256;
+	std::vector<double> inputs((size_t)BATCH * 4), expected((size_t)BATCH * numOutputs, 0.0);
+	for (int b = 0; b < BATCH; ++b) {
+		for (int k = 0; k < 4; ++k) inputs[(size_t)b * 4 + k] = ((b * 7 + k * 13) % 101) / 100.0;
+		expected[(size_t)b * numOutputs + b % numOutputs] = 1.0;
+	}
+
+	int reps = std::max(1, 200000 / StaticNetwork<Sizes...>::STORAGE_SIZE);
+	double sink = 0.0;
+	results.push_back(measure("predict", params, samples, reps, [&] {
+		for (int r = 0; r < reps; ++r) sink += network->predict(&inputs[(size_t)(r % BATCH) * 4], ws)[0];
+	}));
+	int trainReps = std::max(1, reps / 3);
+	results.push_back(measure("train", params, samples, trainReps, [&] {
+		for (int r = 0; r < trainReps; ++r) network->train(&inputs[(size_t)(r % BATCH) * 4], &expected[(size_t)(r % BATCH) * numOutputs], ws);
+	}));
+	if (sink == 12345.0) cout << ""; // never true, just uses sink
+	delete network;
+}
+
+// Entry point of the benchmark build. Options: --quick (fewer samples), --threads N, --kernels NAME.
+int runBenchmarks(int argc, char* argv[])
+{
+	bool quick = false;
+	int threads = 1;
+	std::string kernelName = "auto";
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--quick") quick = true;
+		else if (arg == "--threads" && i + 1 < argc) threads = std::atoi(argv[++i]);
+		else if (arg == "--kernels" && i + 1 < argc) kernelName = argv[++i];
+		else {
+			cout << "usage: " << argv[0] << " [--quick] [--threads N] [--kernels NAME]\n";
+			return 1;
+		}
+	}
+	if (threads < 1) threads = 1;
+	if (!selectKernels(kernelName)) {
+		cout << "Kernels '" << kernelName << "' are not supported on this CPU.\n";
+		return 1;
+	}
+	int samples = quick ? 50 : 500;
+	const unsigned long long SEED = 1; // same mazes every run
+	ThreadPool pool(threads);
+	std::vector<BenchResult> results;
+
+	// --- RANDOM NUMBERS ---
+	// the old global rand() against the counter-based generator, drawing grid coordinates like spawning does
+	{
+		const int DRAWS = 100000;
+		const int RANGE = 1000;
+		long long sink = 0;
+		srand(1);
+		results.push_back(measure("rand", "below_1000", samples, DRAWS, [&] {
+			for (int d = 0; d < DRAWS; ++d) sink += rand() % RANGE;
+		}));
+		CounterRng rng(SEED, 0, CounterRng::STREAM_WALLS);
+		results.push_back(measure("counter_rng", "below_1000", samples, DRAWS, [&] {
+			for (int d = 0; d < DRAWS; ++d) sink += rng.below(RANGE);
+		}));
+		// a fresh stream for every draw, like every student getting their own (the key is the expensive part)
+		long long student = 0;
+		results.push_back(measure("counter_rng_keyed", "below_1000", samples, DRAWS, [&] {
+			for (int d = 0; d < DRAWS; ++d) sink += CounterRng(SEED, 0, CounterRng::STREAM_STUDENTS, student++).below(RANGE);
+		}));
+		if (sink == 12345) cout << ""; // never true, just uses sink
+	}
+
+	// --- NEURAL NETWORK ---
+	int topologies[][4] = {{4, 8, 4, 0}, {4, 32, 4, 0}, {4, 64, 64, 4}, {4, 256, 256, 4}}; // a 0 at the end means 3 layers
+	for (int* topology : topologies) {
+		int size = topology[3] ? 4 : 3;
+		std::string params = topologyName(topology, size);
+		NeuralNetwork network(topology, size);
+		NeuralNetwork::Workspace ws = network.makeWorkspace();
+		int numOutputs = network.outputSize();
+
+		// one fixed set of made up samples, spread over the input range
+		const int BATCH = 256;
+		std::vector<double> inputs((size_t)BATCH * 4), expected((size_t)BATCH * numOutputs, 0.0);
+		for (int b = 0; b < BATCH; ++b) {
+			for (int k = 0; k < 4; ++k) inputs[(size_t)b * 4 + k] = ((b * 7 + k * 13) % 101) / 100.0;
+			expected[(size_t)b * numOutputs + b % numOutputs] = 1.0;
+		}
+
+		// work per sample grows with the weights, so smaller networks do more operations per sample
+		int reps = std::max(1, 200000 / network.storage_size);
+		double sink = 0.0; // keeps the compiler from throwing the predictions away
+		results.push_back(measure("predict", params, samples, reps, [&] {
+			for (int r = 0; r < reps; ++r) sink += network.predict(&inputs[(size_t)(r % BATCH) * 4], ws)[0];
+		}));
+
+		// the same predictions with the float and int8 copies of the weights
+		for (Precision precision : {PRECISION_FLOAT, PRECISION_INT8}) {
+			ReducedNetwork reduced;
+			reduced.copyFrom(network, precision);
+			ReducedNetwork::Workspace rws = reduced.makeWorkspace();
+			results.push_back(measure(std::string("predict_") + PRECISION_NAMES[precision], params, samples, reps, [&] {
+				for (int r = 0; r < reps; ++r) sink += reduced.predict(&inputs[(size_t)(r % BATCH) * 4], rws)[0];
+			}));
+		}
+
+		int batchReps = std::max(1, reps / BATCH);
+		for (Precision precision : {PRECISION_FLOAT, PRECISION_INT8}) {
+			ReducedNetwork reduced;
+			reduced.copyFrom(network, precision);
+			ReducedNetwork::Workspace rws = reduced.makeWorkspace(BATCH);
+			results.push_back(measure(std::string("predict_batch_256_") + PRECISION_NAMES[precision], params, samples, batchReps * BATCH, [&] {
+				for (int r = 0; r < batchReps; ++r) sink += reduced.predictBatch(inputs.data(), BATCH, rws)[0];
+			}));
+		}
+
+		NeuralNetwork::BatchWorkspace bws = network.makeBatchWorkspace(BATCH);
+		results.push_back(measure("predict_batch_256", params, samples, batchReps * BATCH, [&] {
+			for (int r = 0; r < batchReps; ++r) sink += network.predictBatch(inputs.data(), BATCH, bws)[0];
+		}));
+
+		int trainReps = std::max(1, reps / 3);
+		results.push_back(measure("train", params, samples, trainReps, [&] {
+			for (int r = 0; r < trainReps; ++r) network.train(&inputs[(size_t)(r % BATCH) * 4], &expected[(size_t)(r % BATCH) * numOutputs], ws);
+		}));
+
+		NeuralNetwork::TrainingWorkspace tws = network.makeTrainingWorkspace(BATCH, pool.size());
+		int trainBatchReps = std::max(1, trainReps / BATCH);
+		results.push_back(measure("train_batch_256", params, samples, trainBatchReps * BATCH, [&] {
+			network.trainBatch(inputs.data(), expected.data(), BATCH, BATCH, trainBatchReps, tws, pool); // epochs over the same batch
+		}));
+		if (sink == 12345.0) cout << ""; // never true, just uses sink
+	}
+
+	benchmarkStaticNetwork<4, 8, 4>(results, samples);
+	benchmarkStaticNetwork<4, 32, 4>(results, samples);
+	benchmarkStaticNetwork<4, 64, 64, 4>(results, samples);
+
+	// --- STUDENTS ---
+	int brainTopology[] = {4, 8, 4};
+	sharedBrain = new NeuralNetwork(brainTopology, 3);
+	struct WorldSize { int size; int students; };
+	const WorldSize WORLDS[] = {{10, 5}, {100, 100}, {1000, 1000}, {1000, 10000}};
+	for (const WorldSize &shape : WORLDS) {
+		std::string params = std::to_string(shape.size) + "x" + std::to_string(shape.size) + "/" + std::to_string(shape.students);
+		World world;
+		world.grid.resize(shape.size, shape.size);
+		StepContext ctx;
+		ctx.setup(&pool, shape.students, world);
+		StudentPopulation students;
+		long long generation = 0;
+		spawnGeneration(world, students, shape.students, SEED, generation++);
+
+		// planning one move for every student (what tryMove used to do, without the network)
+		MovePlan plan;
+		results.push_back(measure("plan_move", params, samples, shape.students, [&] {
+			for (int i = 0; i < shape.students; ++i) students.planMove(i, false, world.friendX, world.friendY, plan);
+		}));
+
+		// whole steps, starting over whenever everyone has gathered
+		bool friendFound = false;
+		int knownFX = world.friendX, knownFY = world.friendY;
+		int stepSamples = quick ? 20 : 200;
+		results.push_back(measure("simulation_step", params, stepSamples, 1, [&] {
+			if (students.allGathered()) {
+				spawnGeneration(world, students, shape.students, SEED, generation++);
+				friendFound = false;
+				knownFX = world.friendX;
+				knownFY = world.friendY;
+			}
+			simulationStep(students, friendFound, knownFX, knownFY, ctx);
+		}));
+	}
+	delete sharedBrain;
+	sharedBrain = nullptr;
+
+	cout << "{\n  \"kernels\":\"" << kernels->name << "\",\"threads\":" << pool.size() << ",\"samples\":" << samples << ",\n  \"results\":[\n";
+	for (size_t r = 0; r < results.size(); ++r) printBenchResult(results[r], r + 1 == results.size());
+	cout << "  ]\n}\n";
+	return 0;
+}
+#endif